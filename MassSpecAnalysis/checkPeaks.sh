@@ -0,0 +1,47 @@
+#!/bin/sh
+# checkPeaks.sh - check that findMassSpecPeaks -sweep finds, for every
+# setting, the peaks a run with that setting alone finds.
+#
+#   sh checkPeaks.sh <spectrum>
+#
+# The settings are a grid of window sizes, peak sizes and thresholds,
+# and the spectrum one of ../MassSpecData unless given. make check
+# runs it. The exit status is 1 if any setting differs.
+
+spectrum=${1:-"../MassSpecData/Monday, February 25, 2008  13_18 C LM4-10 new 9.csv"}
+settings=${TMPDIR:-/tmp}/checkPeaks-$$.txt
+swept=${TMPDIR:-/tmp}/checkPeaks-$$.csv
+trap 'rm -f "$settings" "$swept"' 0
+
+: > "$settings"
+for window in 2 3 4 5 6; do
+  for peak in 0.5 1 2 3 4; do
+    for threshold in 1.05 1.2 1.5; do
+      awk "BEGIN {exit !($window > $peak)}" &&
+        echo "$window,$peak,$threshold" >> "$settings"
+    done
+  done
+done
+
+./findMassSpecPeaks -sweep "$settings" "$spectrum" 2>/dev/null |
+  tail -n +2 > "$swept"
+
+# A single run prints its peaks after the ".. " of its update lines
+numFailed=0
+setting=0
+while IFS=, read window peak threshold; do
+  setting=$((setting + 1))
+  alone=$(./findMassSpecPeaks -window_size $window -peak_size $peak \
+            -threshold $threshold "$spectrum" |
+          sed -n 's/^ Update current.*) \.\. //p' | tr ' ' '\n' | grep . |
+          sort)
+  inSweep=$(awk -F, -v setting=$setting '$1 == setting {print $5}' "$swept" |
+            sort)
+  if [ "$alone" != "$inSweep" ]; then
+    echo " Setting $window,$peak,$threshold: the sweep and a single run differ"
+    numFailed=$((numFailed + 1))
+  fi
+done < "$settings"
+
+echo " $numFailed of $setting sweep settings differ"
+[ $numFailed -eq 0 ]
@@ -0,0 +1,62 @@
+#!/bin/sh
+# checkSequences.sh - check expandPeptideSequences against the b and y
+# ions of a known sequence.
+#
+#   sh checkSequences.sh
+#
+# The sequence is GASGP, with G twice, so its composition has 60
+# distinct orderings. Against its ions the expansion must give GASGP,
+# drop some orderings that don't fit, and give no ordering twice; with
+# every cleavage allowed to be missing, it must give all 60, once each.
+# make check runs it. The exit status is 1 if any of that fails.
+
+program=$(pwd)/expandPeptideSequences
+work=${TMPDIR:-/tmp}/checkSequences-$$
+trap 'rm -rf "$work"' 0
+mkdir "$work" && cd "$work" || exit 1
+
+# The b and y ions of GASGP at each cleavage, with the search's masses
+cat > peaks.txt <<PEAKS
+58.0589
+129.1371
+216.2148
+273.2664
+116.1383
+173.1899
+260.2676
+331.3458
+PEAKS
+
+# G, A, S and P, in the order of the composition files, and the mass
+echo "2,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,387.3901" \
+  > Compositions-check-1.csv
+
+numFailed=0
+
+"$program" check 1 peaks.txt > /dev/null || exit 1
+tail -n +2 Sequences-check-1.csv | cut -d, -f2 | sort > fitted.txt
+numFitted=$(wc -l < fitted.txt)
+if ! grep -qx GASGP fitted.txt; then
+  echo " GASGP was not given"
+  numFailed=$((numFailed + 1))
+fi
+if [ "$numFitted" -ge 60 ]; then
+  echo " No ordering was dropped ($numFitted of 60 given)"
+  numFailed=$((numFailed + 1))
+fi
+if [ -n "$(uniq -d fitted.txt)" ]; then
+  echo " An ordering was given twice"
+  numFailed=$((numFailed + 1))
+fi
+
+"$program" -max_missing 4 check 1 peaks.txt > /dev/null || exit 1
+tail -n +2 Sequences-check-1.csv | cut -d, -f2 | sort > all.txt
+numAll=$(sort -u all.txt | wc -l)
+if [ "$(wc -l < all.txt)" -ne 60 ] || [ "$numAll" -ne 60 ]; then
+  echo " Without pruning $(wc -l < all.txt) orderings were given," \
+    "$numAll distinct, not 60"
+  numFailed=$((numFailed + 1))
+fi
+
+echo " $numFailed sequence checks failed ($numFitted of 60 orderings fit GASGP)"
+[ $numFailed -eq 0 ]
@@ -9,10 +9,38 @@
  * designed to support web services by making the instantiations
  * uniquely identified by an ID, the first command line argument.
  * 
- * Usage: computePeptideComposition ID targetMass <targetMass>  ...
+ * Usage: computePeptideComposition <options> ID targetMass <targetMass>  ...
  *
  * where:
  *
+ * options are any of:
+ *
+ *   -tolerance #  : the tolerance in Daltons within which a mass is a
+ *                   match, which should be the error in the peak mass
+ *   -split_cost # : the estimated number of combinations above which
+ *                   a subtree of the search is given its own thread
+ *   -show_costs   : print the estimated and actual cost of every
+ *                   subtree given its own thread, for tuning the above
+ *   -deadline #   : stop searching after this many milliseconds,
+ *                   keeping the compositions found so far and
+ *                   reporting how much of the search was covered
+ *   -progress #   : print a progress line to stderr every this many
+ *                   milliseconds
+ *   -status file  : write the latest progress line to this file
+ *                   (every second unless -progress says otherwise)
+ *   -shard i/N    : search only the i'th (from 1) of N shards of the
+ *                   search space, so that one search can be spread
+ *                   over several processes or machines
+ *   -metrics file : write the time, combinations and matches of each
+ *                   mass, and the CPU time and memory of the run, to
+ *                   this file in the Prometheus text format, after
+ *                   each mass
+ *   -merge_isobaric : search types closer in mass than the tolerance
+ *                   (such as Q and K) as one class, and write the
+ *                   matches by class
+ *   -expand       : with -merge_isobaric, also expand the class
+ *                   matches into the compositions they hold
+ *
  * ID Is a uniqe run ID. This is used to form the name of all internal
  * filenames according to the specification for the SSEAPS project.
  *
@@ -24,6 +52,46 @@
  * and that column holds the counts for that type for the found
  * composition. The last column holds the target mass
  *
+ * With -merge_isobaric, types whose masses differ by less than the
+ * tolerance from the next lighter are merged into a class, searched
+ * as its lightest member, and a match is any count of the classes
+ * whose range of masses, from all the lightest to all the heaviest
+ * member, meets the window. These are written, with a header naming
+ * the classes and the range of each, to ClassCompositions-ID-N.csv,
+ * and Compositions-ID-N.csv is only written if -expand is given: each
+ * class match is then split every way among the members of its
+ * classes and those whose exact mass is in the window are written as
+ * usual, the same compositions as searching the types would find. The
+ * classes are not merged if their spread would widen the window to
+ * half the lightest acid, beyond which the search would miss matches.
+ *
+ * When sharded, the output file name also names the shard, and the
+ * shard writes a statistics file alongside it. The shards are split
+ * by the counts of the first SHARD_TYPES types, each prefix weighted
+ * by its estimated cost, in a way that depends only on the mass and
+ * N, so that every shard agrees on who does what. Once all are done,
+ * mergePeptideCompositions combines them into the files an unsharded
+ * run would have written, the class composition files included.
+ *
+ * OR
+ *
+ * computePeptideComposition <options> -verify # <-seed #> <ID mass ...>
+ *
+ * checks the engines against each other rather than searching: for
+ * the given number of random peptides (reproducible from the seed)
+ * and any masses given, every engine is run on the same target and
+ * the sets of compositions it finds must be exactly those of the
+ * reference, the plain recursion of computePeptideComposition. The
+ * engines are the threaded search as configured, the same forced to
+ * split nearly everywhere, the search run as shards, and the search
+ * by classes, expanded. Unless a
+ * tolerance is given each peptide gets one of a few tolerances. A
+ * mismatch is shrunk to the smallest peptide that still shows it and
+ * printed with the command line that reproduces it, and the exit
+ * status is then 1. Nothing is written to files. The tolerance and
+ * split cost are the only options that go with it; make check runs
+ * it on 50 peptides.
+ *
  * OR
  *
  * computePeptideComposition
@@ -40,7 +108,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 
 /* For the threaded implementation */
 #include <pthread.h>
@@ -48,8 +118,11 @@
 
 /* File-Scope Constants, Macros, and Enumerations */
 
-/* This determines at what level of the recursion we STOP making threads */
-#define THREAD_LEVEL (5)
+/* 
+ * This is the default estimated cost (in combinations) of a subtree
+ * above which it is searched in its own thread
+ */
+#define SPLIT_COST (2.0e6)
 
 /* 
  * This is the number of amino acid types that can be in a peptide:
@@ -64,9 +137,46 @@
  */
 #define MAX_PEPTIDE_SIZE (20)
 
-/* This is the tolerance in the mass to declare a match */
+/* This is the default tolerance in the mass to declare a match */
 #define TOLERANCE (0.000)
 
+/* 
+ * This is the number of types whose counts make up the prefixes the
+ * search is sharded by, and so the most prefixes there can be.
+ */
+#define SHARD_TYPES (2)
+#define MAX_SHARD_PREFIXES ((MAX_PEPTIDE_SIZE+1)*(MAX_PEPTIDE_SIZE+1))
+
+/* This is how often, in milliseconds, the search monitor wakes up */
+#define MONITOR_TICK (10)
+
+/* 
+ * These are the most acids in a random peptide checked by -verify,
+ * which keeps the reference search fast, and the split cost and
+ * number of shards the engines are checked with
+ */
+#define VERIFY_PEPTIDE_SIZE (8)
+#define VERIFY_SPLIT_COST (1.0e4)
+#define VERIFY_SHARDS (3)
+#define VERIFY_ENGINES (4)
+
+/* This is the usage error */
+#define USAGE(pname) \
+  {printf("Usage: %s <-tolerance #> <-split_cost #> <-show_costs> " \
+	  "<-deadline #> "						\
+	  "<-progress #> <-status file> <-shard i/N> <-metrics file> "	\
+	  "<-merge_isobaric> <-expand> "				\
+	  "<-verify #> <-seed #> "					\
+	  "ID mass <mass> ...\n",					\
+	  pname);						\
+    exit(1);}
+
+/* 
+ * This is the first of the types that are solved in closed form
+ * rather than by recursion: the last two types in the table
+ */
+#define LEAF_TYPE_INDEX (NUM_AMINO_ACID_TYPES-2)
+
 /* File-Scope Type Definitions */
 
 /* A data base entry for an amino acid, which is initialized below */
@@ -90,8 +200,27 @@ typedef struct {
 
   long currentMass;		/* The current Mass */
   long numCombinations;		/* Number of combinations attempted */
+
+  int splitSearch;		/* Set if children may get threads */
+  double searchShare;		/* Share of the whole search space */
 } TYPE_ARGUMENTS;
 
+/* What the metrics say about the search for each mass */
+typedef struct {
+  double mass;
+  double seconds;
+  double covered;
+  long numCombinations;
+  int numMatches;
+} MASS_METRICS;
+
+/* A set of compositions, as the counts of each type, found by -verify */
+typedef struct {
+  int numCompositions;
+  int maxCompositions;
+  char (*counts)[NUM_AMINO_ACID_TYPES];
+} COMPOSITION_SET;
+
 /* File-Scope Variables */
 
 /* 
@@ -113,12 +242,92 @@ static int maxAcids;
 static int tolerance;
 static long targetMass;
 
+/* 
+ * This is the estimated cost above which a subtree gets a thread and
+ * whether to print those costs, both set from the command line
+ */
+static int showCosts = 0;
+static double splitCost = SPLIT_COST;
+
+/* 
+ * These control the monitoring of the search: the progress interval
+ * and the status file are set from the command line, the deadline
+ * and start time for each search.
+ */
+static long deadline = 0;
+static long progressInterval = 0;
+static char *statusFileName = NULL;
+static struct timeval searchStartTime;
+
+/* 
+ * These flag the search to stop and the monitor that the search is
+ * done. They are written by one thread and only read by the others.
+ */
+static volatile int stopSearch = 0;
+static volatile int searchDone = 0;
+
+/* 
+ * This is the progress of the search: the combinations tried and the
+ * share of the search space covered by the subtrees finished, and the
+ * matches when it started. Access is mutex protected.
+ */
+static int startMatches;
+static long nodesVisited;
+static double coveredShare;
+static pthread_mutex_t progressMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 
+ * This is which shard of how many we are to search (0 of 0 being all
+ * of it) and, once searched, the cost of our shard and of them all
+ */
+static int shardIndex = 0;
+static int numShards = 0;
+static long shardCost;
+static long allShardsCost;
+
+/* This is where the metrics go, if anywhere */
+static char *metricsFileName = NULL;
+
+/* 
+ * When searching by classes of near isobaric types: whether to, and
+ * to expand their matches, the class of each type (the index of its
+ * lightest member) and the masses of its lightest and heaviest, the
+ * masses of the types as they were, and the target and tolerance the
+ * search window was widened from. The class matches go to classFp,
+ * semaphore protected.
+ */
+static int mergeIsobaric = 0;
+static int expandClasses = 0;
+static int typeClasses[NUM_AMINO_ACID_TYPES];
+static long classMaxMasses[NUM_AMINO_ACID_TYPES];
+static long unmergedMasses[NUM_AMINO_ACID_TYPES];
+static long classTarget;
+static int classTolerance;
+static FILE *classFp = NULL;
+
 /* This is used to keep the file prints from becoming intertwined */
 static sem_t *printMutex;
 
+/* 
+ * This counts the processors free to search a subtree without
+ * threads, so that only as many of those run at once as there are
+ * processors and they finish one after the other rather than all at
+ * the end, which is what makes the progress meaningful.
+ */
+static sem_t *workerSlots;
+
 /* This is the output file pointer, semaphore protected */
 static FILE *outputFp = NULL;
 
+/* 
+ * When checking the engines, the compositions go into this set
+ * instead, also semaphore protected
+ */
+static COMPOSITION_SET *captureSet = NULL;
+
+/* The state of the random peptides checked by -verify */
+static unsigned long long verifySeed = 1;
+
 static AMINO_ACID_DATA aminoAcidData[NUM_AMINO_ACID_TYPES] = {
   "G", "Glycine",        "C2H5NO2",       75.0669,
   "A", "Alanine",        "C3H7NO2",       89.0935,
@@ -145,11 +354,45 @@ static AMINO_ACID_DATA aminoAcidData[NUM_AMINO_ACID_TYPES] = {
 /* This is integer versions of the weights */
 static long typeMasses[NUM_AMINO_ACID_TYPES];
 
+/* 
+ * These are used by the cost estimate: the logarithms of the
+ * factorials, and the sums of the masses and of the logarithms of
+ * the masses of all types from each type on.
+ */
+static double logFactorials[MAX_PEPTIDE_SIZE+NUM_AMINO_ACID_TYPES+1];
+static double logMassSums[NUM_AMINO_ACID_TYPES+1];
+static long massSums[NUM_AMINO_ACID_TYPES+1];
+
 /* This is the output file type */
 
 /* File-Scope Prototypes */
 static void *processType(void *vTypeArgument);
+static void solveLeafTypes(TYPE_ARGUMENTS *typeArgument);
+static double searchComposition(TYPE_ARGUMENTS *typeArguments,
+				long deadlineTime);
+static double estimateCost(TYPE_ARGUMENTS *typeArgument);
+static void searchShard(TYPE_ARGUMENTS *typeArguments);
+static void addShardPrefixes(TYPE_ARGUMENTS *typeArgument,
+			     TYPE_ARGUMENTS *prefixes,
+			     int *numPrefixes);
+static long shardPrefixCost(TYPE_ARGUMENTS *typeArgument);
+static void recordProgress(TYPE_ARGUMENTS *typeArgument);
+static void *monitorSearch(void *vUnused);
+static void reportProgress(int final);
 static void printCounts(TYPE_ARGUMENTS *typeArgument);
+static void mergeClasses(void);
+static void unmergeClasses(void);
+static void expandClass(int *classCounts, int *typeCounts, int typeIndex,
+			int numLeft, long currentMass);
+static void writeClassHeader(FILE *fp);
+static void addComposition(COMPOSITION_SET *set, int *typeCounts);
+static int compareCompositions(const void *first, const void *second);
+static void referenceType(int numLeft, int typeIndex, long currentMass,
+			  int *typeCounts, COMPOSITION_SET *set);
+static int verifyMass(double inputMass, int report, int *numFound);
+static int verifyRandom(int range);
+static void writeMetrics(char *idName, MASS_METRICS *massMetrics,
+			 int numMasses);
 
 /*+F
  ********************************************************
@@ -165,8 +408,10 @@ static void printCounts(TYPE_ARGUMENTS *typeArgument);
  * mass and the counts properly reduced for the next type.
  *
  * In order to speed the process, this routine will spawn threads ot
- * execute lower levels of the recursion for the first few layers of
- * recursion. Otherwise, it recurses directly.
+ * execute lower levels of the recursion for those subtrees whose
+ * estimated cost is above the split cost. Otherwise, it recurses
+ * directly, so that small masses do not pay for threads they do not
+ * need and large ones are not left waiting on a few huge threads.
  *
  * In order to recurse in a thread-safe manner, this routine will
  * instantiate local variables to hold the inputs to lower levels of
@@ -184,6 +429,8 @@ static void printCounts(TYPE_ARGUMENTS *typeArgument);
  * currentMass - the currentMass, accumulated over prior types
  * numCombinations - the number of combinations tried so far (used for stats)
  * typeCounts - a vector of counts assigned for each type so far. 
+ * splitSearch - set if this subtree may give its children threads
+ * searchShare - the share of the whole search space in this subtree
  *
  * numAcids is thus the sum of typeCounts
  * 
@@ -199,22 +446,33 @@ static void *processType(void *vTypeArguments)
   /* The base case: we have no types left to assign */
   if (inputArguments->typeIndex == NUM_AMINO_ACID_TYPES) return(NULL);
 
+  /* The last two types do not need recursion: solve them directly */
+  if (inputArguments->typeIndex == LEAF_TYPE_INDEX) {
+    solveLeafTypes(inputArguments);
+    return(NULL);
+  }
+
   /* 
-   * Now, if the type index is lower than the specified threadLevel,
-   * we implement this loop using threads for any recursions
+   * Now, if this subtree is big enough to be split, we implement this
+   * loop using threads for those recursions that are themselves big
+   * enough and recurse directly on the rest.
    */
-  if (inputArguments->typeIndex < THREAD_LEVEL) {
+  if (inputArguments->splitSearch) {
 
     /* Threat bookeeping information */
     int typeCount;
+    int numChildren;
     int numThreads = 0;
+    double totalCost = 0.0;
+    int threadIndices[MAX_PEPTIDE_SIZE+1];
     pthread_t threadIds[MAX_PEPTIDE_SIZE+1];
+    double threadCosts[MAX_PEPTIDE_SIZE+1];
 
     /* To be thread-safe, we have to have arguments for each thread */
     TYPE_ARGUMENTS *threadArgument;
     TYPE_ARGUMENTS threadArguments[MAX_PEPTIDE_SIZE+1];
 
-    /* Now try each type count possibility */
+    /* Now set up each type count possibility */
     for (typeCount=0, threadArgument = threadArguments;
 	 typeCount<= maxAcids - inputArguments->numAcids;
 	 typeCount++, threadArgument++) {
@@ -239,26 +497,68 @@ static void *processType(void *vTypeArguments)
       threadArgument->numCombinations = 1;
       
       /* If this mass is too big, then we are done with this loop */
-      if (threadArgument->currentMass > targetMass+TOLERANCE) break;
+      if (threadArgument->currentMass > targetMass+tolerance) break;
 
       /* If we found a match, print it */
-      if (threadArgument->currentMass >= targetMass-TOLERANCE) {
+      if (threadArgument->currentMass >= targetMass-tolerance) {
 	printCounts(threadArgument);
 	break;
       }
 
-      /* Otherwise spawn a thread */
+      /* Otherwise see whether it is worth a thread */
+      threadCosts[typeCount] = estimateCost(threadArgument);
+      threadArgument->splitSearch = threadCosts[typeCount] > splitCost;
+      totalCost += threadCosts[typeCount];
+    }
+    numChildren = typeCount;
+
+    /* 
+     * Each of them gets a share of the search space in proportion to
+     * its cost, so that finished ones can be added up as coverage.
+     */
+    for (typeCount=0;typeCount<numChildren;typeCount++)
+      threadArguments[typeCount].searchShare =
+	inputArguments->searchShare * threadCosts[typeCount] / totalCost;
+
+    /* Spawn the threads for the ones that are worth it ... */
+    for (typeCount=0;typeCount<numChildren && !stopSearch;typeCount++) {
+      if (!threadArguments[typeCount].splitSearch) continue;
+      threadIndices[numThreads] = typeCount;
       pthread_create(&threadIds[numThreads++],
 		     NULL,
 		     processType,
-		     threadArgument);
+		     &threadArguments[typeCount]);
+    }
+
+    /* ... and do the rest here while they run */
+    for (typeCount=0;typeCount<numChildren && !stopSearch;typeCount++) {
+      threadArgument = &threadArguments[typeCount];
+      if (threadArgument->splitSearch) continue;
+      sem_wait(workerSlots);
+      processType(threadArgument);
+      sem_post(workerSlots);
+      inputArguments->numCombinations += threadArgument->numCombinations;
+      recordProgress(threadArgument);
     }
 
     /* Join any threads we created and do bookeeping on the modified inputs */
     while(--numThreads >=0) {
       pthread_join(threadIds[numThreads],NULL);
-      inputArguments->numCombinations +=
-	threadArguments[numThreads].numCombinations;
+      threadArgument = &threadArguments[threadIndices[numThreads]];
+      inputArguments->numCombinations += threadArgument->numCombinations;
+
+      /* Show the estimate against what it actually took */
+      if (showCosts) {
+	sem_wait(printMutex);
+	printf(" Subtree ");
+	for (typeCount=0;typeCount<threadArgument->typeIndex;typeCount++)
+	  printf("%s%d",aminoAcidData[typeCount].symbol,
+		 threadArgument->typeCounts[typeCount]);
+	printf(" Estimated %.3g Actual %ld\n",
+	       threadCosts[threadIndices[numThreads]],
+	       threadArgument->numCombinations);
+	sem_post(printMutex);
+      }
     }
     
   } else {
@@ -271,13 +571,13 @@ static void *processType(void *vTypeArguments)
      * faster.
      */
     typeIndex = inputArguments->typeIndex++;
-    while (inputArguments->numAcids <= maxAcids) {
+    while (inputArguments->numAcids <= maxAcids && !stopSearch) {
       
       /* If this mass is too big, then we are done with this loop */
-      if (inputArguments->currentMass > targetMass+TOLERANCE) break;
+      if (inputArguments->currentMass > targetMass+tolerance) break;
       
       /* If we found a match, print it */
-      if (inputArguments->currentMass >= targetMass-TOLERANCE) {
+      if (inputArguments->currentMass >= targetMass-tolerance) {
 	printCounts(inputArguments);
 	break;
       }
@@ -302,6 +602,527 @@ static void *processType(void *vTypeArguments)
 
   return(NULL);
 }
+/*+F
+ ********************************************************
+ * 
+ * solveLeafTypes - assign the last two types in closed form
+ *
+ * Once only two types are left the count of the last one is fully
+ * determined by the mass remaining after the count of the one before
+ * it, so instead of recursing one acid at a time this computes the
+ * remaining mass for every count of the penultimate type as a batch
+ * and then the count of the last type by a single ceiling division.
+ *
+ * The matches found, and the order they are found in, are exactly
+ * those of the recursion: a match on the penultimate type alone ends
+ * the search and only the smallest count of the last type that
+ * reaches the window is considered.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArgument - the arguments, with the typeIndex
+ * set to LEAF_TYPE_INDEX. Only numCombinations is modified on return.
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void solveLeafTypes(TYPE_ARGUMENTS *typeArgument)
+{
+  int typeCount, numLeft, numBatch;
+  int lastMass, leafMass;
+  long currentMass;
+
+  /* The batch of remaining masses and the last type count for each */
+  int remainingMass[MAX_PEPTIDE_SIZE+2];
+  int lastCounts[MAX_PEPTIDE_SIZE+1];
+
+  numLeft = maxAcids - typeArgument->numAcids;
+  leafMass = typeMasses[LEAF_TYPE_INDEX];
+  lastMass = typeMasses[LEAF_TYPE_INDEX+1];
+  currentMass = typeArgument->currentMass;
+
+  /* 
+   * First the batch of remaining masses for every count of the
+   * penultimate type that does not overshoot the target ...
+   */
+  remainingMass[0] = targetMass - currentMass;
+  for (numBatch=0;
+       numBatch <= numLeft && remainingMass[numBatch] >= -tolerance;
+       numBatch++)
+    remainingMass[numBatch+1] = remainingMass[numBatch] - leafMass;
+
+  /* 
+   * ... and then the smallest count of the last type that reaches
+   * the window for each. This loop has no branches so that the
+   * compiler can vectorize it.
+   */
+  for (typeCount=0;typeCount<numBatch;typeCount++)
+    lastCounts[typeCount] =
+      (remainingMass[typeCount] - tolerance + lastMass - 1) / lastMass;
+
+  /* Now go through them in order just as the recursion would */
+  for (typeCount=0;typeCount<numBatch;typeCount++) {
+
+    typeArgument->numCombinations++;
+
+    /* A match without any of the last type ends the search */
+    if (remainingMass[typeCount] <= tolerance) {
+      typeArgument->typeCounts[LEAF_TYPE_INDEX] = typeCount;
+      typeArgument->currentMass = targetMass - remainingMass[typeCount];
+      printCounts(typeArgument);
+      break;
+    }
+
+    /* Otherwise see if that count of the last type fits */
+    if (typeCount + lastCounts[typeCount] <= numLeft &&
+	lastCounts[typeCount] * lastMass <=
+	remainingMass[typeCount] + tolerance) {
+      typeArgument->typeCounts[LEAF_TYPE_INDEX] = typeCount;
+      typeArgument->typeCounts[LEAF_TYPE_INDEX+1] = lastCounts[typeCount];
+      typeArgument->currentMass = targetMass - remainingMass[typeCount] +
+	lastCounts[typeCount] * lastMass;
+      printCounts(typeArgument);
+    }
+  }
+
+  /* Put the input back the way we found it */
+  typeArgument->typeCounts[LEAF_TYPE_INDEX] = 0;
+  typeArgument->typeCounts[LEAF_TYPE_INDEX+1] = 0;
+  typeArgument->currentMass = currentMass;
+}
+/*+F
+ ********************************************************
+ * 
+ * estimateCost - estimate the number of combinations in a subtree
+ *
+ * This estimates how many combinations the search below the given
+ * arguments will try, so that only the subtrees that are worth it
+ * are given threads. It is the smaller of two counts of the ways to
+ * assign the types that remain (less the last, which is solved
+ * directly):
+ *
+ * - ignoring mass, the number of ways to assign at most the number of
+ *   acids left, which is what bounds small masses, and
+ *
+ * - ignoring the number of acids, the volume of the simplex of counts
+ *   whose mass is below the mass left (grown by half an acid of each
+ *   type to account for the counts on its faces), which is what
+ *   bounds large ones and is what makes subtrees heavy in the light
+ *   types dwarf the rest.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArgument - the arguments at the top of the subtree
+ * 
+ * Returns: the estimated number of combinations
+ ********************************************************
+ */
+static double estimateCost(TYPE_ARGUMENTS *typeArgument)
+{
+  int numLeft, numTypes;
+  long remainingMass;
+  double countCost, massCost;
+
+  /* The types left to recurse over, and the mass and acids left */
+  numTypes = NUM_AMINO_ACID_TYPES - 1 - typeArgument->typeIndex;
+  numLeft = maxAcids - typeArgument->numAcids;
+  remainingMass = targetMass + tolerance - typeArgument->currentMass;
+  if (numTypes <= 1 || numLeft <= 0 || remainingMass <= 0) return(1.0);
+
+  /* No more acids than the lightest of those left can fit */
+  if (remainingMass / typeMasses[typeArgument->typeIndex] < numLeft)
+    numLeft = remainingMass / typeMasses[typeArgument->typeIndex];
+
+  /* The number of ways to put numLeft or fewer into numTypes */
+  countCost = exp(logFactorials[numLeft + numTypes] -
+		  logFactorials[numLeft] - logFactorials[numTypes]);
+
+  /* The volume of counts with mass no more than that remaining */
+  massCost = exp(numTypes * log(remainingMass + 0.5 *
+				(massSums[typeArgument->typeIndex] -
+				 massSums[NUM_AMINO_ACID_TYPES-1])) -
+		 logFactorials[numTypes] -
+		 (logMassSums[typeArgument->typeIndex] -
+		  logMassSums[NUM_AMINO_ACID_TYPES-1]));
+
+  return(countCost < massCost ? countCost : massCost);
+}
+/*+F
+ ********************************************************
+ * 
+ * searchComposition - search for all compositions of the target mass
+ *
+ * This sets up the arguments for the top of the recursion and runs
+ * it, splitting it into threads if the whole search is worth it.
+ *
+ * If a deadline is given, or progress is to be reported, it runs a
+ * monitor thread alongside the search that does so. At the deadline
+ * the monitor flags the search to stop, which all the workers check
+ * as they go, so that the compositions found so far are kept and the
+ * share of the search space that was covered can be reported.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArguments - the arguments, which on return hold
+ * the number of combinations searched.
+ * long deadlineTime - milliseconds to search for (0 = no limit)
+ * 
+ * Returns: the share of the search space covered (1.0 if finished)
+ ********************************************************
+ */
+static double searchComposition(TYPE_ARGUMENTS *typeArguments,
+				long deadlineTime)
+{
+  pthread_t monitorId;
+
+  if (mergeIsobaric) mergeClasses();
+  memset(typeArguments,0,sizeof(*typeArguments));
+  typeArguments->searchShare = 1.0;
+  typeArguments->splitSearch = estimateCost(typeArguments) > splitCost;
+
+  /* Reset the progress and start the monitor if we need one */
+  nodesVisited = 0;
+  coveredShare = 0.0;
+  startMatches = numMatches;
+  stopSearch = searchDone = 0;
+  deadline = deadlineTime;
+  gettimeofday(&searchStartTime,NULL);
+  if (deadline > 0 || progressInterval > 0)
+    pthread_create(&monitorId,NULL,monitorSearch,NULL);
+
+  /* Do the search, which unless sharded or split is one big subtree */
+  if (numShards > 1) {
+    searchShard(typeArguments);
+  } else if (typeArguments->splitSearch) {
+    processType(typeArguments);
+  } else {
+    sem_wait(workerSlots);
+    processType(typeArguments);
+    sem_post(workerSlots);
+    recordProgress(typeArguments);
+  }
+
+  /* Let the monitor know and wait for it */
+  searchDone = 1;
+  if (deadline > 0 || progressInterval > 0)
+    pthread_join(monitorId,NULL);
+  if (statusFileName != NULL) reportProgress(1);
+
+  if (mergeIsobaric) unmergeClasses();
+  if (stopSearch)
+    printf("Deadline reached: searched %.1f%% of the search space\n",
+	   100.0 * coveredShare);
+  return(stopSearch ? coveredShare : 1.0);
+}
+/*+F
+ ********************************************************
+ * 
+ * searchShard - search our shard of the search space
+ *
+ * This breaks the search into the prefixes made by the counts of the
+ * first SHARD_TYPES types, deals them out to the shards, and searches
+ * those dealt to us much as processType would.
+ *
+ * The prefixes are dealt largest first to whichever shard has the
+ * least so far, both by cost and ties by order, so the shards come
+ * out about even. The cost used is shardPrefixCost, rather than
+ * estimateCost, because it is done in integers and so comes out the
+ * same on every machine, which the shards depend on to agree.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArguments - the arguments for the top of the
+ * search, which on return hold the number of combinations searched.
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void searchShard(TYPE_ARGUMENTS *typeArguments)
+{
+  int index, order, shard, numPrefixes = 0, numThreads = 0;
+  int prefixOrder[MAX_SHARD_PREFIXES];
+  int prefixShards[MAX_SHARD_PREFIXES];
+  int threadIndices[MAX_SHARD_PREFIXES];
+  long prefixCosts[MAX_SHARD_PREFIXES];
+  long *shardLoads;
+  pthread_t threadIds[MAX_SHARD_PREFIXES];
+  TYPE_ARGUMENTS *prefix;
+  TYPE_ARGUMENTS prefixes[MAX_SHARD_PREFIXES];
+
+  /* Get the prefixes, their costs, and sort them largest first */
+  addShardPrefixes(typeArguments,prefixes,&numPrefixes);
+  for (index=0;index<numPrefixes;index++) {
+    prefixCosts[index] = shardPrefixCost(&prefixes[index]);
+    for (order=index;
+	 order > 0 && prefixCosts[prefixOrder[order-1]] < prefixCosts[index];
+	 order--)
+      prefixOrder[order] = prefixOrder[order-1];
+    prefixOrder[order] = index;
+  }
+
+  /* Now deal them out to whoever has the least so far */
+  if ((shardLoads = calloc(numShards,sizeof(long))) == NULL) {
+    printf("Unable to allocate %d shards\n",numShards);
+    exit(1);
+  }
+  for (order=0;order<numPrefixes;order++) {
+    index = prefixOrder[order];
+    prefixShards[index] = 0;
+    for (shard=1;shard<numShards;shard++)
+      if (shardLoads[shard] < shardLoads[prefixShards[index]])
+	prefixShards[index] = shard;
+    shardLoads[prefixShards[index]] += prefixCosts[index];
+  }
+  shardCost = shardLoads[shardIndex];
+  for (allShardsCost=0, index=0;index<numShards;index++)
+    allShardsCost += shardLoads[index];
+  free(shardLoads);
+
+  /* 
+   * Set up ours: those that are already a match just get printed,
+   * the rest get a share of our shard and the ones worth it a thread.
+   */
+  for (index=0, prefix=prefixes;index<numPrefixes;index++, prefix++) {
+    if (prefixShards[index] != shardIndex) continue;
+    prefix->searchShare = (double)prefixCosts[index] / shardCost;
+    if (prefix->typeIndex == NUM_AMINO_ACID_TYPES) {
+      printCounts(prefix);
+      recordProgress(prefix);
+      continue;
+    }
+    prefix->splitSearch = estimateCost(prefix) > splitCost;
+    if (prefix->splitSearch && !stopSearch) {
+      threadIndices[numThreads] = index;
+      pthread_create(&threadIds[numThreads++],NULL,processType,prefix);
+    }
+  }
+
+  /* Do the rest here while they run */
+  for (index=0, prefix=prefixes;index<numPrefixes;index++, prefix++) {
+    if (prefixShards[index] != shardIndex ||
+	prefix->typeIndex == NUM_AMINO_ACID_TYPES ||
+	prefix->splitSearch || stopSearch) continue;
+    sem_wait(workerSlots);
+    processType(prefix);
+    sem_post(workerSlots);
+    typeArguments->numCombinations += prefix->numCombinations;
+    recordProgress(prefix);
+  }
+
+  /* And collect the threads */
+  while(--numThreads >=0) {
+    pthread_join(threadIds[numThreads],NULL);
+    typeArguments->numCombinations +=
+      prefixes[threadIndices[numThreads]].numCombinations;
+  }
+}
+/*+F
+ ********************************************************
+ * 
+ * addShardPrefixes - list the prefixes the search is sharded by
+ *
+ * This goes through the counts of the first SHARD_TYPES types just as
+ * processType does and adds each set of counts that reaches the end
+ * of them to the list. A set of counts that is already a match is
+ * added too, with its typeIndex set past the last type to mark it.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArgument - the arguments so far
+ * TYPE_ARGUMENTS *prefixes - the list to add them to
+ * int *numPrefixes - the number in the list, updated
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void addShardPrefixes(TYPE_ARGUMENTS *typeArgument,
+			     TYPE_ARGUMENTS *prefixes,
+			     int *numPrefixes)
+{
+  int typeCount;
+  TYPE_ARGUMENTS prefix;
+
+  /* If we have all the counts, this is a prefix */
+  if (typeArgument->typeIndex == SHARD_TYPES) {
+    prefixes[(*numPrefixes)++] = *typeArgument;
+    return;
+  }
+
+  for (typeCount=0;
+       typeCount <= maxAcids - typeArgument->numAcids;
+       typeCount++) {
+
+    prefix = *typeArgument;
+    prefix.numAcids += typeCount;
+    prefix.typeCounts[typeArgument->typeIndex] = typeCount;
+    prefix.currentMass += typeCount * typeMasses[prefix.typeIndex++];
+    prefix.numCombinations = 1;
+
+    /* If this mass is too big, then we are done with this loop */
+    if (prefix.currentMass > targetMass+tolerance) break;
+
+    /* If we found a match, mark it as such */
+    if (prefix.currentMass >= targetMass-tolerance) {
+      prefix.typeIndex = NUM_AMINO_ACID_TYPES;
+      prefixes[(*numPrefixes)++] = prefix;
+      break;
+    }
+
+    addShardPrefixes(&prefix,prefixes,numPrefixes);
+  }
+}
+/*+F
+ ********************************************************
+ * 
+ * shardPrefixCost - the cost of a prefix when dealing out shards
+ *
+ * This is the number of ways to put the acids left into the types
+ * left (less the last), where no more acids are left than the
+ * lightest of those types can fit in the mass left. Unlike
+ * estimateCost this is done entirely in integers.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArgument - the arguments for the prefix
+ * 
+ * Returns: the cost, at least 1
+ ********************************************************
+ */
+static long shardPrefixCost(TYPE_ARGUMENTS *typeArgument)
+{
+  int index, numLeft, numTypes;
+  long cost, remainingMass;
+
+  if (typeArgument->typeIndex >= LEAF_TYPE_INDEX) return(1);
+  numTypes = NUM_AMINO_ACID_TYPES - 1 - typeArgument->typeIndex;
+  numLeft = maxAcids - typeArgument->numAcids;
+  remainingMass = targetMass + tolerance - typeArgument->currentMass;
+  if (remainingMass / typeMasses[typeArgument->typeIndex] < numLeft)
+    numLeft = remainingMass / typeMasses[typeArgument->typeIndex];
+
+  /* Each step is itself a binomial coefficient, so it divides exactly */
+  for (cost=1, index=1;index<=numTypes;index++)
+    cost = cost * (numLeft + index) / index;
+
+  return(cost);
+}
+/*+F
+ ********************************************************
+ * 
+ * recordProgress - add a finished subtree to the progress
+ *
+ * This adds the combinations of a subtree searched without threads
+ * to the progress and, unless it was stopped short, its share of the
+ * search space to that covered.
+ *
+ * Parameters:
+ *
+ * TYPE_ARGUMENTS *typeArgument - the arguments for the subtree
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void recordProgress(TYPE_ARGUMENTS *typeArgument)
+{
+  pthread_mutex_lock(&progressMutex);
+  nodesVisited += typeArgument->numCombinations;
+  if (!stopSearch) coveredShare += typeArgument->searchShare;
+  pthread_mutex_unlock(&progressMutex);
+}
+/*+F
+ ********************************************************
+ * 
+ * monitorSearch - watch the search for the deadline and progress
+ *
+ * This runs as its own thread alongside the search, waking up every
+ * MONITOR_TICK milliseconds until the search is done. It flags the
+ * search to stop once the deadline has passed and reports the
+ * progress every progressInterval milliseconds.
+ *
+ * Parameters:
+ *
+ * void *vUnused - required by the pthreads interface
+ * 
+ * Returns: NULL
+ ********************************************************
+ */
+static void *monitorSearch(void *vUnused)
+{
+  long elapsed, lastReport = 0;
+  struct timeval currentTime;
+
+  (void)vUnused;
+  while (!searchDone) {
+    usleep(1000 * MONITOR_TICK);
+    gettimeofday(&currentTime,NULL);
+    elapsed = 1000 * (currentTime.tv_sec - searchStartTime.tv_sec) +
+      (currentTime.tv_usec - searchStartTime.tv_usec) / 1000;
+
+    if (deadline > 0 && elapsed >= deadline) stopSearch = 1;
+
+    if (progressInterval > 0 && elapsed - lastReport >= progressInterval) {
+      reportProgress(0);
+      lastReport = elapsed;
+    }
+  }
+  return(NULL);
+}
+/*+F
+ ********************************************************
+ * 
+ * reportProgress - print a line describing the progress of the search
+ *
+ * This prints the time so far, the combinations tried, the matches,
+ * the share of the search space covered, and from those an estimate
+ * of the time left. The line goes to stderr and, if one was given,
+ * the status file, which is written to a temporary file and renamed
+ * so that a reader never sees it half written.
+ *
+ * Parameters:
+ *
+ * int final - set once the search is over, which is then noted
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void reportProgress(int final)
+{
+  char line[256];
+  char tempName[256];
+  double elapsed, covered, remaining;
+  struct timeval currentTime;
+  FILE *statusFp;
+
+  gettimeofday(&currentTime,NULL);
+  elapsed = currentTime.tv_sec - searchStartTime.tv_sec +
+    1e-6 * (currentTime.tv_usec - searchStartTime.tv_usec);
+
+  pthread_mutex_lock(&progressMutex);
+  covered = coveredShare;
+  sprintf(line,"%s %.3f s, %ld nodes, %d matches, %.1f%% covered",
+	  final ? (stopSearch ? "Stopped" : "Done") : "Progress",
+	  elapsed, nodesVisited, numMatches - startMatches, 100.0 * covered);
+  pthread_mutex_unlock(&progressMutex);
+
+  /* The time left assumes the rest goes as fast as what we did */
+  if (!final) {
+    remaining = covered > 0.0 ? elapsed * (1.0 - covered) / covered : -1.0;
+    if (remaining >= 0.0)
+      sprintf(line+strlen(line),", ETA %.1f s",remaining);
+    else
+      strcat(line,", ETA unknown");
+    fprintf(stderr,"%s\n",line);
+  }
+
+  if (statusFileName != NULL) {
+    sprintf(tempName,"%s.tmp",statusFileName);
+    if ((statusFp = fopen(tempName,"w")) != NULL) {
+      fprintf(statusFp,"%s\n",line);
+      fclose(statusFp);
+      rename(tempName,statusFileName);
+    }
+  }
+}
 /*+F
  ********************************************************
  * 
@@ -318,11 +1139,43 @@ static void *processType(void *vTypeArguments)
 static void printCounts(TYPE_ARGUMENTS *typeArgument)
 {
   int itype;
+  long highMass;
+  int typeCounts[NUM_AMINO_ACID_TYPES];
+
+  /* 
+   * A class match is what the widened window lets through whose range
+   * of masses meets the real one
+   */
+  if (mergeIsobaric) {
+    highMass = typeArgument->currentMass;
+    for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+      highMass += typeArgument->typeCounts[itype] *
+	(classMaxMasses[itype] - typeMasses[itype]);
+    if (highMass < classTarget - classTolerance ||
+	typeArgument->currentMass > classTarget + classTolerance) return;
+
+    sem_wait(printMutex);
+    if (classFp != NULL) {
+      for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+	if (typeClasses[itype] == itype)
+	  fprintf(classFp,"%02d,",typeArgument->typeCounts[itype]);
+      fprintf(classFp,"%.4f,%.4f\n",
+	      (double)(typeArgument->currentMass)/10000,
+	      (double)highMass/10000);
+    }
+    if (expandClasses || captureSet != NULL)
+      expandClass(typeArgument->typeCounts,typeCounts,0,0,0);
+    else
+      numMatches++;
+    sem_post(printMutex);
+    return;
+  }
 
   /* Semaphore protect this */
   sem_wait(printMutex);
 
   numMatches++;
+  if (captureSet != NULL) addComposition(captureSet,typeArgument->typeCounts);
   if (outputFp != NULL) {
     for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++) 
       fprintf(outputFp,"%02d,",typeArgument->typeCounts[itype]);
@@ -332,6 +1185,419 @@ static void printCounts(TYPE_ARGUMENTS *typeArgument)
   sem_post(printMutex);
 
 }
+/*+F
+ ********************************************************
+ * 
+ * mergeClasses - merge the near isobaric types into classes
+ *
+ * Each type closer than the tolerance to the next lighter (the table
+ * is in order of mass) joins its class. The other members are then
+ * given a mass above the window, so that the search only ever takes
+ * none of them, and the window is widened below by the most the
+ * classes can spread in maxAcids acids, so that every count of the
+ * classes whose range meets the window is found. printCounts sorts
+ * out which really do. If that would widen the window to half the
+ * lightest acid, nothing is merged.
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void mergeClasses(void)
+{
+  int itype;
+  long spread = 0;
+
+  for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++) {
+    unmergedMasses[itype] = typeMasses[itype];
+    typeClasses[itype] = itype;
+    if (itype > 0 && typeMasses[itype] - typeMasses[itype-1] < tolerance)
+      typeClasses[itype] = typeClasses[itype-1];
+    classMaxMasses[typeClasses[itype]] = typeMasses[itype];
+    if (typeMasses[itype] - typeMasses[typeClasses[itype]] > spread)
+      spread = typeMasses[itype] - typeMasses[typeClasses[itype]];
+  }
+
+  /* An even spread, so that the window moves by whole units */
+  spread *= maxAcids;
+  spread += spread & 1;
+  if (2 * (tolerance + spread / 2) >= typeMasses[0]) {
+    for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++) {
+      typeClasses[itype] = itype;
+      classMaxMasses[itype] = typeMasses[itype];
+    }
+    spread = 0;
+  }
+
+  classTarget = targetMass;
+  classTolerance = tolerance;
+  targetMass -= spread / 2;
+  tolerance += spread / 2;
+  for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+    if (typeClasses[itype] != itype)
+      typeMasses[itype] = classTarget + classTolerance + 1;
+}
+/*+F
+ ********************************************************
+ * 
+ * unmergeClasses - put the types and window back after mergeClasses
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void unmergeClasses(void)
+{
+  int itype;
+
+  for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+    typeMasses[itype] = unmergedMasses[itype];
+  targetMass = classTarget;
+  tolerance = classTolerance;
+}
+/*+F
+ ********************************************************
+ * 
+ * expandClass - expand a class match into its compositions
+ *
+ * This splits the count of each class every way among its members,
+ * in the order of the types, and keeps those whose mass is in the
+ * window. It is called with the print semaphore held.
+ *
+ * Parameters:
+ *
+ * int *classCounts - the count of each class, under its lightest
+ * int *typeCounts - the counts of the types so far
+ * int typeIndex - the type to assign at this level
+ * int numLeft - the count left to its class
+ * long currentMass - the mass so far
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void expandClass(int *classCounts, int *typeCounts, int typeIndex,
+			int numLeft, long currentMass)
+{
+  int itype, typeCount, lastMember;
+
+  if (typeIndex == NUM_AMINO_ACID_TYPES) {
+    if (currentMass < classTarget - classTolerance ||
+	currentMass > classTarget + classTolerance) return;
+    numMatches++;
+    if (captureSet != NULL) addComposition(captureSet,typeCounts);
+    if (outputFp != NULL) {
+      for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++) 
+	fprintf(outputFp,"%02d,",typeCounts[itype]);
+      fprintf(outputFp,"%.4f\n",(double)currentMass/10000);
+    }
+    return;
+  }
+
+  /* The lightest member starts its class, the heaviest takes the rest */
+  if (typeClasses[typeIndex] == typeIndex) numLeft = classCounts[typeIndex];
+  lastMember = typeIndex + 1 == NUM_AMINO_ACID_TYPES ||
+    typeClasses[typeIndex+1] != typeClasses[typeIndex];
+
+  for (typeCount=lastMember ? numLeft : 0;typeCount<=numLeft;typeCount++) {
+    typeCounts[typeIndex] = typeCount;
+    expandClass(classCounts,typeCounts,typeIndex+1,numLeft-typeCount,
+		currentMass + typeCount * unmergedMasses[typeIndex]);
+  }
+}
+/*+F
+ ********************************************************
+ * 
+ * writeClassHeader - write the header of a class composition file
+ *
+ * Each class is named by its members, and the last two columns are
+ * the lowest and highest mass of the match.
+ *
+ * Parameters:
+ *
+ * FILE *fp - the class composition file
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeClassHeader(FILE *fp)
+{
+  int itype;
+
+  for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++) {
+    if (itype > 0 && typeClasses[itype] != itype &&
+	typeClasses[itype] == typeClasses[itype-1])
+      fprintf(fp,"%s",aminoAcidData[itype].symbol);
+    else
+      fprintf(fp,"%s%s",itype > 0 ? "," : "",aminoAcidData[itype].symbol);
+  }
+  fprintf(fp,",LowMass,HighMass\n");
+}
+/*+F
+ ********************************************************
+ * 
+ * addComposition - add a composition to a set
+ *
+ * Parameters:
+ *
+ * COMPOSITION_SET *set - the set
+ * int *typeCounts - the count of each type
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void addComposition(COMPOSITION_SET *set, int *typeCounts)
+{
+  int itype;
+
+  if (set->numCompositions == set->maxCompositions) {
+    set->maxCompositions =
+      set->maxCompositions > 0 ? 2 * set->maxCompositions : 1024;
+    if ((set->counts = realloc(set->counts,set->maxCompositions *
+			       sizeof(*set->counts))) == NULL) {
+      printf("Unable to allocate %d compositions\n",set->maxCompositions);
+      exit(1);
+    }
+  }
+  for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+    set->counts[set->numCompositions][itype] = typeCounts[itype];
+  set->numCompositions++;
+}
+/*+F
+ ********************************************************
+ * 
+ * compareCompositions - order two compositions for qsort
+ *
+ * Returns: as memcmp
+ ********************************************************
+ */
+static int compareCompositions(const void *first, const void *second)
+{
+  return(memcmp(first,second,NUM_AMINO_ACID_TYPES));
+}
+/*+F
+ ********************************************************
+ * 
+ * referenceType - the search of computePeptideComposition
+ *
+ * This is the plain recursion of the serial program, one acid at a
+ * time with no threads, leaf solver or other shortcuts, which the
+ * engines are checked against.
+ *
+ * Parameters:
+ *
+ * int numLeft - the number of acids left to assign
+ * int typeIndex - the type to assign at this level
+ * long currentMass - the mass so far
+ * int *typeCounts - the counts so far
+ * COMPOSITION_SET *set - where to put the compositions found
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void referenceType(int numLeft, int typeIndex, long currentMass,
+			  int *typeCounts, COMPOSITION_SET *set)
+{
+  int typeCount;
+  long newMass;
+
+  if (typeIndex == NUM_AMINO_ACID_TYPES) return;
+
+  for (typeCount=0;typeCount <= numLeft; typeCount++) {
+    typeCounts[typeIndex] = typeCount;
+    newMass = currentMass + typeCount * typeMasses[typeIndex];
+    if (newMass > targetMass+tolerance) break;
+    if (newMass >= targetMass-tolerance) {
+      addComposition(set,typeCounts);
+      break;
+    }
+    referenceType(numLeft - typeCount,typeIndex+1,newMass,typeCounts,set);
+  }
+
+  typeCounts[typeIndex] = 0;
+}
+/*+F
+ ********************************************************
+ * 
+ * verifyMass - check every engine against the reference for a mass
+ *
+ * Parameters:
+ *
+ * double inputMass - the mass to search for, at the current tolerance
+ * int report - whether to print what differs
+ * int *numFound - the number of compositions the reference found
+ * 
+ * Returns: the number of engines that do not match the reference
+ ********************************************************
+ */
+static int verifyMass(double inputMass, int report, int *numFound)
+{
+  static char *engineNames[] = {"threaded","split","sharded","classes"};
+  int engine, index, itype, missing, numFailed = 0;
+  char *shown;
+  int typeCounts[NUM_AMINO_ACID_TYPES];
+  double savedSplitCost = splitCost;
+  COMPOSITION_SET referenceSet = {0}, engineSet = {0};
+  TYPE_ARGUMENTS typeArguments;
+
+  targetMass = round(inputMass * 10000);
+  maxAcids = ceil((inputMass + tolerance / 10000.0)/aminoAcidData[0].mass);
+  if (maxAcids > MAX_PEPTIDE_SIZE) maxAcids = MAX_PEPTIDE_SIZE;
+
+  memset(typeCounts,0,sizeof(typeCounts));
+  referenceType(maxAcids,0,0,typeCounts,&referenceSet);
+  qsort(referenceSet.counts,referenceSet.numCompositions,
+	sizeof(*referenceSet.counts),compareCompositions);
+  *numFound = referenceSet.numCompositions;
+
+  for (engine=0;engine<VERIFY_ENGINES;engine++) {
+
+    /* Run the engine into its own set */
+    engineSet.numCompositions = 0;
+    captureSet = &engineSet;
+    if (engine == 1) splitCost = VERIFY_SPLIT_COST;
+    if (engine == 2) {
+      numShards = VERIFY_SHARDS;
+      for (shardIndex=0;shardIndex<numShards;shardIndex++)
+	searchComposition(&typeArguments,0);
+      numShards = shardIndex = 0;
+    } else if (engine == 3) {
+      mergeIsobaric = 1;
+      searchComposition(&typeArguments,0);
+      mergeIsobaric = 0;
+    } else {
+      searchComposition(&typeArguments,0);
+    }
+    splitCost = savedSplitCost;
+    captureSet = NULL;
+
+    /* And compare it, sorted, with the reference */
+    qsort(engineSet.counts,engineSet.numCompositions,
+	  sizeof(*engineSet.counts),compareCompositions);
+    for (index=0;
+	 index < referenceSet.numCompositions &&
+	   index < engineSet.numCompositions &&
+	   !compareCompositions(referenceSet.counts[index],
+				engineSet.counts[index]);
+	 index++)
+      ;
+    if (index == referenceSet.numCompositions &&
+	index == engineSet.numCompositions) continue;
+    numFailed++;
+    if (!report) continue;
+
+    /* Show the first composition where they part */
+    missing = index < referenceSet.numCompositions &&
+      (index == engineSet.numCompositions ||
+       compareCompositions(referenceSet.counts[index],
+			   engineSet.counts[index]) < 0);
+    shown = missing ? referenceSet.counts[index] : engineSet.counts[index];
+    printf(" Mass %.4f tolerance %.4f: reference found %d, %s found %d\n",
+	   inputMass,tolerance / 10000.0,referenceSet.numCompositions,
+	   engineNames[engine],engineSet.numCompositions);
+    printf("  first %s %s: ",missing ? "missing from" : "extra in",
+	   engineNames[engine]);
+    for (itype=0;itype<NUM_AMINO_ACID_TYPES;itype++)
+      printf("%s%d",aminoAcidData[itype].symbol,shown[itype]);
+    printf("\n");
+  }
+
+  free(referenceSet.counts);
+  free(engineSet.counts);
+  return(numFailed);
+}
+/*+F
+ ********************************************************
+ * 
+ * verifyRandom - the next random number for -verify
+ *
+ * This is a plain linear congruential generator rather than rand()
+ * so that a seed gives the same peptides on every machine.
+ *
+ * Parameters:
+ *
+ * int range - the numbers are from 0 to range-1
+ * 
+ * Returns: the random number
+ ********************************************************
+ */
+static int verifyRandom(int range)
+{
+  verifySeed = verifySeed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return((int)((verifySeed >> 33) % range));
+}
+/*+F
+ ********************************************************
+ * 
+ * writeMetrics - write the metrics of the run so far
+ *
+ * They are written in the Prometheus text format, to a temporary
+ * file renamed into place, so that whatever collects them never sees
+ * half a file. The search itself is not touched, so this costs
+ * nothing while it runs.
+ *
+ * Parameters:
+ *
+ * char *idName - the run ID, which labels them all
+ * MASS_METRICS *massMetrics - the metrics of each mass searched
+ * int numMasses - how many masses have been searched
+ * 
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeMetrics(char *idName, MASS_METRICS *massMetrics,
+			 int numMasses)
+{
+  static char *names[] = {"seconds","nodes","matches","covered_ratio"};
+  static char *helps[] = {"Wall time of the search",
+			  "Combinations tried by the search",
+			  "Compositions found by the search",
+			  "Share of the search space covered"};
+  char tempName[256];
+  int metric, index;
+  long maxRss;
+  struct rusage usage;
+  FILE *fp;
+
+  sprintf(tempName,"%s.tmp",metricsFileName);
+  if ((fp = fopen(tempName,"w")) == NULL) {
+    printf("Unable to open file <%s>\n",tempName);
+    return;
+  }
+
+  for (metric=0;metric<4;metric++) {
+    fprintf(fp,"# HELP peptide_search_%s %s for a mass\n",
+	    names[metric],helps[metric]);
+    fprintf(fp,"# TYPE peptide_search_%s gauge\n",names[metric]);
+    for (index=0;index<numMasses;index++) {
+      fprintf(fp,"peptide_search_%s{id=\"%s\",mass=\"%.4f\"} ",
+	      names[metric],idName,massMetrics[index].mass);
+      if (metric == 0) fprintf(fp,"%.3f\n",massMetrics[index].seconds);
+      if (metric == 1) fprintf(fp,"%ld\n",massMetrics[index].numCombinations);
+      if (metric == 2) fprintf(fp,"%d\n",massMetrics[index].numMatches);
+      if (metric == 3) fprintf(fp,"%.6f\n",massMetrics[index].covered);
+    }
+  }
+
+  /* And what the whole run has used */
+  getrusage(RUSAGE_SELF,&usage);
+  fprintf(fp,"# HELP peptide_search_cpu_seconds_total CPU time of the run\n");
+  fprintf(fp,"# TYPE peptide_search_cpu_seconds_total counter\n");
+  fprintf(fp,"peptide_search_cpu_seconds_total{id=\"%s\",mode=\"user\"} "
+	  "%.3f\n",idName,usage.ru_utime.tv_sec + 1e-6*usage.ru_utime.tv_usec);
+  fprintf(fp,"peptide_search_cpu_seconds_total{id=\"%s\",mode=\"system\"} "
+	  "%.3f\n",idName,usage.ru_stime.tv_sec + 1e-6*usage.ru_stime.tv_usec);
+
+  /* Which Linux gives in kilobytes and macOS in bytes */
+#ifdef __APPLE__
+  maxRss = usage.ru_maxrss;
+#else
+  maxRss = 1024L * usage.ru_maxrss;
+#endif
+  fprintf(fp,"# HELP peptide_search_max_rss_bytes Peak memory of the run\n");
+  fprintf(fp,"# TYPE peptide_search_max_rss_bytes gauge\n");
+  fprintf(fp,"peptide_search_max_rss_bytes{id=\"%s\"} %ld\n",idName,maxRss);
+
+  fclose(fp);
+  rename(tempName,metricsFileName);
+}
 /* The main routine. It runs in two different modes:
  *
  * When invoked with NO command line arguments, it runs a bunch of 
@@ -349,39 +1615,260 @@ int main(int argc, char**argv)
 {
   char *pName, *idName;
   char semName[128];
+  char slotName[128];
   char fileName[128];
   
   int itype,itry,index;
+  int verifyCount = -1, numFailed, numChecked, numFound, numAcids;
+  int toleranceGiven = 0;
+  int peptide[VERIFY_PEPTIDE_SIZE];
+  double verifyTolerances[5] = {0.0, 0.0010, 0.0100, 0.1000, 0.5000};
   
   float runTime;
-  double inputMass;
+  double inputMass, covered;
 
-  struct timeval startTime, endTime;
+  long timeLeft = 0;
+  long runDeadline = 0;
+  long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
 
-  TYPE_ARGUMENTS typeArguments;
+  struct timeval startTime, searchTime, endTime;
 
-  /* Load the initial arguments */
-  typeArguments.numAcids = 0;
-  typeArguments.typeIndex = 0;
-  typeArguments.currentMass = 0;
-  memset(typeArguments.typeCounts,0,sizeof(typeArguments.typeCounts));
+  TYPE_ARGUMENTS typeArguments;
+  MASS_METRICS *massMetrics;
 
-  /* Set up the target mass table */
+  /* Set up the target mass table and the tolerance */
   for (index=0;index<NUM_AMINO_ACID_TYPES;index++)
     typeMasses[index] = round(aminoAcidData[index].mass * 10000);
-  
-  /* Parse the input arguments */
-  if (argc > 1) {
-    pName = argv[0]; argc--; argv++;
-    if (argc < 1) {
-      printf("USAGE: %s ID mass <mass> <mass> \n",pName);
-      exit(1);
+  tolerance = round(TOLERANCE * 10000);
+
+  /* And the tables used to estimate the cost of a subtree */
+  logFactorials[0] = 0.0;
+  for (index=1;index<MAX_PEPTIDE_SIZE+NUM_AMINO_ACID_TYPES+1;index++)
+    logFactorials[index] = logFactorials[index-1] + log((double)index);
+  massSums[NUM_AMINO_ACID_TYPES] = 0;
+  logMassSums[NUM_AMINO_ACID_TYPES] = 0.0;
+  for (index=NUM_AMINO_ACID_TYPES-1;index>=0;index--) {
+    massSums[index] = massSums[index+1] + typeMasses[index];
+    logMassSums[index] =
+      logMassSums[index+1] + log((double)typeMasses[index]);
+  }
+
+  /* Parse the options */
+  pName = argv[0]; argc--; argv++;
+  while (argc > 0 && argv[0][0] == '-') {
+
+    /* 
+     * The tolerance, which must be less than half the lightest acid
+     * for the search to find every match in the window
+     */
+    if (!strcmp(argv[0],"-tolerance")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%lf",&inputMass) != 1 ||
+	  inputMass < 0 || 2 * inputMass >= aminoAcidData[0].mass)
+	USAGE(pName);
+      tolerance = round(inputMass * 10000);
+      toleranceGiven = 1;
+      argc--; argv++;
+      continue;
+    }
+
+    /* The cost above which a subtree gets a thread */
+    if (!strcmp(argv[0],"-split_cost")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%lf",&splitCost) != 1)
+	USAGE(pName);
+      argc--; argv++;
+      continue;
     }
 
-    /* Create the semaphore */
+    /* Whether to show the cost of those subtrees */
+    if (!strcmp(argv[0],"-show_costs")) {
+      showCosts = 1;
+      argc--; argv++;
+      continue;
+    }
+
+    /* How long we have to do all the searching */
+    if (!strcmp(argv[0],"-deadline")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%ld",&runDeadline) != 1)
+	USAGE(pName);
+      argc--; argv++;
+      continue;
+    }
+
+    /* How often to report progress */
+    if (!strcmp(argv[0],"-progress")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%ld",&progressInterval) != 1)
+	USAGE(pName);
+      argc--; argv++;
+      continue;
+    }
+
+    /* And where to write it as well */
+    if (!strcmp(argv[0],"-status")) {
+      argc--; argv++;
+      if (argc == 0) USAGE(pName);
+      statusFileName = argv[0];
+      argc--; argv++;
+      continue;
+    }
+
+    /* Which shard of the search to do, numbered from 1 */
+    if (!strcmp(argv[0],"-shard") || !strcmp(argv[0],"--shard")) {
+      argc--; argv++;
+      if (argc == 0 ||
+	  sscanf(argv[0],"%d/%d",&shardIndex,&numShards) != 2 ||
+	  numShards < 1 || shardIndex < 1 || shardIndex > numShards)
+	USAGE(pName);
+      shardIndex--;
+      argc--; argv++;
+      continue;
+    }
+
+    /* Where to write the metrics */
+    if (!strcmp(argv[0],"-metrics")) {
+      argc--; argv++;
+      if (argc == 0) USAGE(pName);
+      metricsFileName = argv[0];
+      argc--; argv++;
+      continue;
+    }
+
+    /* Whether to search by classes, and to expand what they find */
+    if (!strcmp(argv[0],"-merge_isobaric")) {
+      mergeIsobaric = 1;
+      argc--; argv++;
+      continue;
+    }
+    if (!strcmp(argv[0],"-expand")) {
+      expandClasses = 1;
+      argc--; argv++;
+      continue;
+    }
+
+    /* Whether to check the engines instead, and on what */
+    if (!strcmp(argv[0],"-verify")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%d",&verifyCount) != 1 ||
+	  verifyCount < 0)
+	USAGE(pName);
+      argc--; argv++;
+      continue;
+    }
+    if (!strcmp(argv[0],"-seed")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%llu",&verifySeed) != 1)
+	USAGE(pName);
+      argc--; argv++;
+      continue;
+    }
+
+    /* IF we got here, there was a bad command line argument */
+    USAGE(pName);
+  }
+  if (statusFileName != NULL && progressInterval == 0)
+    progressInterval = 1000;
+  if (expandClasses && !mergeIsobaric) USAGE(pName);
+
+  /* 
+   * The engines checked are configured by the tolerance and split cost
+   * alone; -verify runs the others itself
+   */
+  if (verifyCount >= 0 &&
+      (numShards > 0 || mergeIsobaric || runDeadline > 0))
+    USAGE(pName);
+
+  /* 
+   * Check the engines against the reference: first on the masses
+   * given, then on random peptides, each shrunk if it fails to the
+   * fewest acids that still do.
+   */
+  if (verifyCount >= 0) {
+    idName = argc > 0 ? argv[0] : "verify";
+    if (argc > 0) {
+      argc--; argv++;
+    }
+    sprintf(semName,"computePeptideCompositionMutex-%s",idName);
+    sem_unlink(semName);
+    printMutex = sem_open(semName,O_CREAT,777,1);
+    sprintf(slotName,"computePeptideCompositionSlots-%s",idName);
+    sem_unlink(slotName);
+    workerSlots = sem_open(slotName,O_CREAT,777,numProcessors);
+    printf("     Mass Tolerance #Matches\n");
+
+    numFailed = numChecked = 0;
+    for (;argc > 0;argc--, argv++, numChecked++) {
+      sscanf(argv[0],"%lf",&inputMass);
+      if (verifyMass(inputMass,1,&numFound) > 0) {
+	numFailed++;
+	continue;
+      }
+      printf(" %9.4f %9.4f %8d\n",inputMass,tolerance / 10000.0,numFound);
+    }
+
+    for (itry=0;itry<verifyCount;itry++, numChecked++) {
+
+      /* A random peptide and, unless one was given, tolerance */
+      numAcids = 1 + verifyRandom(VERIFY_PEPTIDE_SIZE);
+      for (index=0;index<numAcids;index++)
+	peptide[index] = verifyRandom(NUM_AMINO_ACID_TYPES);
+      if (!toleranceGiven)
+	tolerance = round(10000 * verifyTolerances[verifyRandom(5)]);
+      for (inputMass=0.0,index=0;index<numAcids;index++)
+	inputMass += aminoAcidData[peptide[index]].mass;
+      if (verifyMass(inputMass,0,&numFound) == 0) {
+	printf(" %9.4f %9.4f %8d\n",inputMass,tolerance / 10000.0,numFound);
+	continue;
+      }
+      numFailed++;
+
+      /* Take acids out for as long as it still fails */
+      for (index=0;index<numAcids && numAcids > 1;) {
+	for (inputMass=0.0,itype=0;itype<numAcids;itype++)
+	  if (itype != index) inputMass += aminoAcidData[peptide[itype]].mass;
+	if (verifyMass(inputMass,0,&numFound) > 0) {
+	  peptide[index] = peptide[--numAcids];
+	  index = 0;
+	} else {
+	  index++;
+	}
+      }
+      for (inputMass=0.0,itype=0;itype<numAcids;itype++)
+	inputMass += aminoAcidData[peptide[itype]].mass;
+      verifyMass(inputMass,1,&numFound);
+      printf("  reproduce with: %s -tolerance %.4f -split_cost %.17g "
+	     "-verify 0 %s %.4f\n",
+	     pName,tolerance / 10000.0,splitCost,idName,inputMass);
+    }
+
+    printf("\n %d of %d failed\n",numFailed,numChecked);
+    sem_close(printMutex);
+    sem_unlink(semName);
+    sem_close(workerSlots);
+    sem_unlink(slotName);
+    exit(numFailed > 0);
+  }
+
+  /* Parse the input arguments */
+  if (argc > 0) {
+
+    /* Create the semaphores */
     idName = argv[0]; argc--; argv++;
     sprintf(semName,"computePeptideCompositionMutex-%s",idName);
     printMutex = sem_open(semName,O_CREAT,777,1);
+    sprintf(slotName,"computePeptideCompositionSlots-%s",idName);
+    sem_unlink(slotName);
+    workerSlots = sem_open(slotName,O_CREAT,777,numProcessors);
+
+    /* The deadline is for all the masses together */
+    gettimeofday(&startTime,NULL);
+
+    if ((massMetrics = calloc(argc,sizeof(MASS_METRICS))) == NULL) {
+      printf("Unable to allocate metrics for %d masses\n",argc);
+      exit(1);
+    }
 
     itry = 0;
     while (argc > 0) {
@@ -391,7 +1878,7 @@ int main(int argc, char**argv)
       targetMass = round(inputMass * 10000);
 
       /* From that compute the maximum number of acids */
-      maxAcids = ceil(inputMass/aminoAcidData[0].mass);
+      maxAcids = ceil((inputMass + tolerance / 10000.0)/aminoAcidData[0].mass);
       if (maxAcids > MAX_PEPTIDE_SIZE) {
 	maxAcids = MAX_PEPTIDE_SIZE;
 	printf("Clipping Peptide Length at %d\n",maxAcids);
@@ -399,22 +1886,88 @@ int main(int argc, char**argv)
 	printf("Max Peptide Length: %d\n",maxAcids);
       }
 
-      /* Open the output file */
-      sprintf(fileName,"Compositions-%s-%d.csv",idName,itry);
-      if ((outputFp = fopen(fileName,"w")) == NULL) {
+      /* Open the output file, which when sharded names the shard */
+      if (numShards > 1)
+	sprintf(fileName,"Compositions-%s-%d-shard-%d-of-%d.csv",
+		idName,itry,shardIndex+1,numShards);
+      else
+	sprintf(fileName,"Compositions-%s-%d.csv",idName,itry);
+      if ((!mergeIsobaric || expandClasses) &&
+	  (outputFp = fopen(fileName,"w")) == NULL) {
 	printf("Unable to open file <%s>\n",fileName);
 	exit(1);
       }
 
-      /* Initialize as necessary */
-      memset(&typeArguments,0,sizeof(typeArguments));
+      /* And the class file, whose header needs the classes */
+      if (mergeIsobaric) {
+	if (numShards > 1)
+	  sprintf(fileName,"ClassCompositions-%s-%d-shard-%d-of-%d.csv",
+		  idName,itry,shardIndex+1,numShards);
+	else
+	  sprintf(fileName,"ClassCompositions-%s-%d.csv",idName,itry);
+	if ((classFp = fopen(fileName,"w")) == NULL) {
+	  printf("Unable to open file <%s>\n",fileName);
+	  exit(1);
+	}
+	mergeClasses();
+	writeClassHeader(classFp);
+	unmergeClasses();
+      }
 
-      /* Process the data */
+      /* 
+       * Process the data in whatever time is left: if none is, the
+       * file is left empty and the search reported as not covered.
+       */
       printf("Process weight %s\n",argv[0]);
-      processType(&typeArguments);
-
-      /* Close the file */
-      fclose(outputFp);
+      gettimeofday(&searchTime,NULL);
+      timeLeft = runDeadline -
+	(1000 * (searchTime.tv_sec - startTime.tv_sec) +
+	 (searchTime.tv_usec - startTime.tv_usec) / 1000);
+      numMatches = 0;
+      if (runDeadline == 0 || timeLeft > 0) {
+	covered = searchComposition(&typeArguments,
+				    runDeadline > 0 ? timeLeft : 0);
+      } else {
+	printf("Deadline reached: searched 0.0%% of the search space\n");
+	memset(&typeArguments,0,sizeof(typeArguments));
+	shardCost = allShardsCost = 0;
+	covered = 0.0;
+      }
+      gettimeofday(&endTime,NULL);
+
+      /* Close the files */
+      if (outputFp != NULL) fclose(outputFp);
+      outputFp = NULL;
+      if (classFp != NULL) fclose(classFp);
+      classFp = NULL;
+      runTime = 1e-6*(endTime.tv_usec - searchTime.tv_usec);
+      runTime += endTime.tv_sec - searchTime.tv_sec;
+
+      /* Keep the metrics, and write them out if wanted */
+      massMetrics[itry].mass = inputMass;
+      massMetrics[itry].seconds = runTime;
+      massMetrics[itry].covered = covered;
+      massMetrics[itry].numCombinations = typeArguments.numCombinations;
+      massMetrics[itry].numMatches = numMatches;
+      if (metricsFileName != NULL)
+	writeMetrics(idName,massMetrics,itry+1);
+
+      /* A shard also leaves its statistics for the merge */
+      if (numShards > 1) {
+	sprintf(fileName,"Statistics-%s-%d-shard-%d-of-%d.csv",
+		idName,itry,shardIndex+1,numShards);
+	if ((outputFp = fopen(fileName,"w")) == NULL) {
+	  printf("Unable to open file <%s>\n",fileName);
+	  exit(1);
+	}
+	fprintf(outputFp,"Mass,Shard,NumShards,ShardCost,TotalCost,"
+		"Matches,Combinations,Covered,RunTime\n");
+	fprintf(outputFp,"%.4f,%d,%d,%ld,%ld,%d,%ld,%.6f,%.3f\n",
+		inputMass,shardIndex+1,numShards,shardCost,allShardsCost,
+		numMatches,typeArguments.numCombinations,covered,runTime);
+	fclose(outputFp);
+	outputFp = NULL;
+      }
 
       /* Next weight please */
       argc--; argv++; itry++;
@@ -422,6 +1975,8 @@ int main(int argc, char**argv)
     /* Close the file */
     sem_close(printMutex);
     sem_unlink(semName);
+    sem_close(workerSlots);
+    sem_unlink(slotName);
     
     exit(0);
   }
@@ -432,11 +1987,13 @@ int main(int argc, char**argv)
    * the maximum number of tries.
    */
   printf("\n\n No command line arguments: run test cases .... \n\n");
-  printf("Timing Numbers (Thread Level %d)\n\n",THREAD_LEVEL);
+  printf("Timing Numbers (Split Cost %.3g)\n\n",splitCost);
   printf(" #Acids RunTime\n");
 
   sem_unlink("testSem");
   printMutex = sem_open("testSem",O_CREAT,777,1);
+  sem_unlink("testSlots");
+  workerSlots = sem_open("testSlots",O_CREAT,777,numProcessors);
   for (index = 3; index < 12; index++) {
 
     /* Set the maximum number of acids from the loop counter */
@@ -446,14 +2003,11 @@ int main(int argc, char**argv)
     sprintf(fileName,"TimingTestCase-%02d.csv",index);
     outputFp = fopen(fileName,"w");
 
-    /* Initialize as necessary */
-    memset(&typeArguments,0,sizeof(typeArguments));
-
     /* Set the target mass */
     targetMass = round(index * typeMasses[NUM_AMINO_ACID_TYPES-1]);
     
     gettimeofday(&startTime,NULL);
-    processType(&typeArguments);
+    searchComposition(&typeArguments,0);
     gettimeofday(&endTime,NULL);
 
     fclose(outputFp);
@@ -473,15 +2027,12 @@ int main(int argc, char**argv)
     for (index=0;index<maxAcids; index++)
       inputMass += aminoAcidData[rand()%NUM_AMINO_ACID_TYPES].mass;
 
-    /* Initialize as necessary */
-    memset(&typeArguments,0,sizeof(typeArguments));
-
     sprintf(fileName,"RedundanceTestCase-%02d.csv",itry);
     outputFp = fopen(fileName,"w");
 
     /* The target mass */
     targetMass = round(inputMass * 10000);
-    processType(&typeArguments);
+    searchComposition(&typeArguments,0);
 
     printf(" %.4f (%d:%ld)\n",
 	   inputMass,numMatches,typeArguments.numCombinations);
@@ -490,5 +2041,7 @@ int main(int argc, char**argv)
   }
   sem_close(printMutex);
   sem_unlink("testSem");
+  sem_close(workerSlots);
+  sem_unlink("testSlots");
   printf("\n\nDone!\n");
 }
@@ -0,0 +1,130 @@
+/*+C
+ ******************************************************************
+ * This picks the points of a spectrum worth plotting, so that a
+ * spectrum of any size can be drawn as a few thousand points that look
+ * like it. It is loaded into R and called with .C; analyzeMassSpec.R
+ * uses it if it has been built, beside the script, with
+ *
+ *   R CMD SHLIB downsampleSpectrum.c
+ *
+ * and plots every point if not. From R:
+ *
+ *   dyn.load("downsampleSpectrum.so")
+ *   picked <- .C("downsampleSpectrum", masses, intensities,
+ *                length(masses), as.integer(keep), length(keep),
+ *                as.integer(numPoints), selected=integer(numPoints+length(keep)),
+ *                numSelected=integer(1))
+ *   shown <- picked$selected[1:picked$numSelected]
+ *
+ * The points are picked by Largest-Triangle-Three-Buckets: the first
+ * and last are kept and the rest split into equal buckets, from each
+ * of which the point kept is the one making the largest triangle with
+ * the point kept before it and the mean of the next bucket. That keeps
+ * the spikes, which is what matters in a spectrum. The points in keep
+ * (the peaks marked on the plot) are always kept, in place of what
+ * their bucket would have given, so the line runs through them.
+ *
+ * All indices are R's, from 1, and those in keep must be increasing.
+ * Nothing R is needed to compile it.
+ ******************************************************************
+ */
+
+/* Includes */
+#include <math.h>
+
+/* File-Scope Prototypes */
+void downsampleSpectrum(double *masses, double *intensities, int *numPoints,
+			int *keep, int *numKeep, int *numWanted,
+			int *selected, int *numSelected);
+
+/*+F
+ ********************************************************
+ *
+ * downsampleSpectrum - pick the points of a spectrum to plot
+ *
+ * Parameters:
+ *
+ * double *masses, *intensities - the spectrum
+ * int *numPoints - how many points it has
+ * int *keep - the points that must be kept, increasing
+ * int *numKeep - how many there are
+ * int *numWanted - the number of points wanted (if fewer than 3, or
+ *                  no fewer than numPoints, all are kept)
+ * int *selected - the points picked, increasing, returned. There must
+ *                 be room for numWanted + numKeep
+ * int *numSelected - how many were picked, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+void downsampleSpectrum(double *masses, double *intensities, int *numPoints,
+			int *keep, int *numKeep, int *numWanted,
+			int *selected, int *numSelected)
+{
+  int n = *numPoints, bucket, numBuckets, start, end, nextEnd;
+  int index, last = 0, best, kept = 0;
+  double bucketSize, meanMass, meanIntensity, area, bestArea;
+
+  *numSelected = 0;
+  if (*numWanted < 3 || *numWanted >= n) {
+    for (index=0;index<n;index++) selected[(*numSelected)++] = index + 1;
+    return;
+  }
+
+  /* The first point, and any to be kept that it covers */
+  selected[(*numSelected)++] = 1;
+  while (kept < *numKeep && keep[kept] <= 1) kept++;
+
+  numBuckets = *numWanted - 2;
+  bucketSize = (double)(n - 2) / numBuckets;
+  for (bucket=0;bucket<numBuckets;bucket++) {
+    start = (int)floor(bucket * bucketSize) + 1;
+    end = (int)floor((bucket + 1) * bucketSize) + 1;
+    if (end > n - 1) end = n - 1;
+
+    /* Points to be kept stand in for the bucket */
+    if (kept < *numKeep && keep[kept] - 1 < end) {
+      while (kept < *numKeep && keep[kept] - 1 < end) {
+	if (keep[kept] - 1 > last) {
+	  last = keep[kept] - 1;
+	  selected[(*numSelected)++] = last + 1;
+	}
+	kept++;
+      }
+      continue;
+    }
+
+    /* The mean of the next bucket, which for the last is the end */
+    nextEnd = (int)floor((bucket + 2) * bucketSize) + 1;
+    if (nextEnd > n) nextEnd = n;
+    meanMass = meanIntensity = 0.0;
+    for (index=end;index<nextEnd;index++) {
+      meanMass += masses[index];
+      meanIntensity += intensities[index];
+    }
+    if (nextEnd > end) {
+      meanMass /= nextEnd - end;
+      meanIntensity /= nextEnd - end;
+    }
+
+    /* And the point of this one making the largest triangle */
+    best = start;
+    bestArea = -1.0;
+    for (index=start;index<end;index++) {
+      area = fabs((masses[last] - meanMass) *
+		  (intensities[index] - intensities[last]) -
+		  (masses[last] - masses[index]) *
+		  (meanIntensity - intensities[last]));
+      if (area > bestArea) {
+	bestArea = area;
+	best = index;
+      }
+    }
+    if (start < end) {
+      last = best;
+      selected[(*numSelected)++] = last + 1;
+    }
+  }
+
+  if (last < n - 1) selected[(*numSelected)++] = n;
+}
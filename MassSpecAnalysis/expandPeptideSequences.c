@@ -0,0 +1,345 @@
+/*+C
+ ******************************************************************
+ * This program expands the compositions found by
+ * computeParallelPeptideComposition into the sequences (orderings)
+ * of each that agree with an MS/MS fragment spectrum.
+ *
+ * Usage: expandPeptideSequences <options> ID N fragmentFile
+ *
+ * where:
+ *
+ * options are any of:
+ *
+ *   -tolerance #   : the tolerance in Daltons within which a fragment
+ *                    ion matches a peak (0.5)
+ *   -max_missing # : the most cleavages that may have neither their b
+ *                    nor their y ion among the peaks (0)
+ *   -max_sequences # : stop after writing this many sequences for a
+ *                    composition (no limit)
+ *
+ * ID and N name the composition file, Compositions-ID-N.csv, as
+ * written by the search. fragmentFile holds the fragment peak masses,
+ * one to a line, as the first number on the line; anything else (a
+ * header, intensities after a comma) is ignored.
+ *
+ * Each distinct ordering of each composition is built a residue at a
+ * time from the N terminus. Every residue added fixes one cleavage: the
+ * b ion of the prefix and the y ion of the rest. If neither is among
+ * the peaks, that cleavage is missing, and once more are missing than
+ * allowed no ordering that starts with the prefix can do better, so it
+ * is dropped there. The search goes depth first and writes each
+ * sequence as it is found, so it needs memory for one sequence however
+ * many orderings there are.
+ *
+ * The fragments are taken as singly charged, with the residue masses
+ * the (average) acid masses of the search less water:
+ *
+ *   b = residues of the prefix + proton
+ *   y = residues of the rest + water + proton
+ *
+ * The sequences are written to Sequences-ID-N.csv, with a header, as
+ * the composition (its line in the composition file, from 1), the
+ * sequence, and how many cleavages matched, and a summary is printed.
+ ******************************************************************
+ */
+
+/* Includes */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* File-Scope Constants, Macros, and Enumerations */
+
+/* This is the number of amino acid types, as in the search */
+#define NUM_AMINO_ACID_TYPES (19)
+
+/* This is the longest peptide we will expand */
+#define MAX_SEQUENCE_SIZE (64)
+
+/* This is the longest line we expect in an input file */
+#define MAX_LINE_SIZE (256)
+
+/* These are the (average) masses of water and a proton, in Daltons */
+#define WATER_MASS (18.0153)
+#define PROTON_MASS (1.00728)
+
+/* These are the defaults of the options */
+#define TOLERANCE (0.5)
+#define MAX_MISSING (0)
+
+/* This is the usage error */
+#define USAGE(pname) \
+  {printf("Usage: %s <-tolerance #> <-max_missing #> <-max_sequences #> " \
+	  "ID N fragmentFile\n",pname); exit(1);}
+
+/* File-Scope Type Definitions */
+
+/* The state of the expansion of one composition */
+typedef struct {
+  int counts[NUM_AMINO_ACID_TYPES]; /* The acids not yet placed */
+  int numAcids;			/* The length of the peptide */
+  double totalMass;		/* The sum of the residue masses */
+  char sequence[MAX_SEQUENCE_SIZE+1]; /* The sequence so far */
+  long numSequences;		/* The sequences written */
+  long numPrefixes;		/* The prefixes tried */
+} EXPANSION;
+
+/* File-Scope Variables */
+
+/* The acids in the order of the composition files, with their masses */
+static char acidSymbols[NUM_AMINO_ACID_TYPES+1] = "GASPVTCLNDQKEMHFRYW";
+static double acidMasses[NUM_AMINO_ACID_TYPES] = {
+  75.0669, 89.0935, 105.0930, 115.1310, 117.1469, 119.1197, 121.1590,
+  131.1736, 132.1184, 133.1032, 146.1451, 146.1882, 147.1299, 149.2124,
+  155.1552, 165.1900, 174.2017, 181.1894, 204.2262
+};
+
+/* And their residue masses, the above less water */
+static double residueMasses[NUM_AMINO_ACID_TYPES];
+
+/* The fragment peaks, sorted */
+static double *peaks = NULL;
+static int numPeaks = 0;
+
+/* The options */
+static double tolerance = TOLERANCE;
+static int maxMissing = MAX_MISSING;
+static long maxSequences = -1;
+
+/* Where the sequences go */
+static FILE *outputFp = NULL;
+
+/* File-Scope Prototypes */
+static void readPeaks(char *fileName);
+static int comparePeaks(const void *first, const void *second);
+static int isPeak(double mass);
+static void expandPrefix(EXPANSION *expansion, int length,
+			 double prefixMass, int numMissing, int row);
+
+/*+F
+ ********************************************************
+ *
+ * comparePeaks - order two peak masses for qsort
+ *
+ * Returns: as strcmp
+ ********************************************************
+ */
+static int comparePeaks(const void *first, const void *second)
+{
+  double difference = *(double *)first - *(double *)second;
+
+  return(difference < 0.0 ? -1 : difference > 0.0 ? 1 : 0);
+}
+/*+F
+ ********************************************************
+ *
+ * readPeaks - read and sort the fragment peaks
+ *
+ * Parameters:
+ *
+ * char *fileName - the fragment file
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void readPeaks(char *fileName)
+{
+  char line[MAX_LINE_SIZE];
+  int maxPeaks = 0;
+  double mass;
+  FILE *fp;
+
+  if ((fp = fopen(fileName,"r")) == NULL) {
+    printf("Unable to open file <%s>\n",fileName);
+    exit(1);
+  }
+
+  while (fgets(line,sizeof(line),fp) != NULL) {
+    if (sscanf(line,"%lf",&mass) != 1) continue;
+    if (numPeaks == maxPeaks) {
+      maxPeaks = maxPeaks > 0 ? 2 * maxPeaks : 256;
+      if ((peaks = realloc(peaks,maxPeaks * sizeof(double))) == NULL) {
+	printf("Unable to allocate %d peaks\n",maxPeaks);
+	exit(1);
+      }
+    }
+    peaks[numPeaks++] = mass;
+  }
+  fclose(fp);
+
+  qsort(peaks,numPeaks,sizeof(double),comparePeaks);
+}
+/*+F
+ ********************************************************
+ *
+ * isPeak - whether there is a peak within the tolerance of a mass
+ *
+ * Parameters:
+ *
+ * double mass - the mass of the ion
+ *
+ * Returns: 1 if there is, 0 if not
+ ********************************************************
+ */
+static int isPeak(double mass)
+{
+  int low = 0, high = numPeaks, middle;
+
+  /* Find the first peak at or above the low end of the window */
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (peaks[middle] < mass - tolerance)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return(low < numPeaks && peaks[low] <= mass + tolerance);
+}
+/*+F
+ ********************************************************
+ *
+ * expandPrefix - write the sequences that start with a prefix
+ *
+ * Each acid left is tried as the next, once for each type, so that
+ * each distinct sequence is made once. The cleavage it fixes is
+ * checked as it is added, and the prefix dropped if too many are
+ * missing.
+ *
+ * Parameters:
+ *
+ * EXPANSION *expansion - the composition and the sequence so far
+ * int length - the length of the prefix
+ * double prefixMass - the sum of its residue masses
+ * int numMissing - the cleavages within it with no ion among the peaks
+ * int row - the composition's line in its file
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void expandPrefix(EXPANSION *expansion, int length,
+			 double prefixMass, int numMissing, int row)
+{
+  int type, missing;
+  double mass;
+
+  if (maxSequences >= 0 && expansion->numSequences >= maxSequences) return;
+
+  /* A whole sequence has no cleavage left to check */
+  if (length == expansion->numAcids) {
+    expansion->sequence[length] = '\0';
+    fprintf(outputFp,"%d,%s,%d\n",row,expansion->sequence,
+	    expansion->numAcids - 1 - numMissing);
+    expansion->numSequences++;
+    return;
+  }
+
+  for (type=0;type<NUM_AMINO_ACID_TYPES;type++) {
+    if (expansion->counts[type] == 0) continue;
+    expansion->numPrefixes++;
+    mass = prefixMass + residueMasses[type];
+
+    /* The last acid closes the sequence rather than a cleavage */
+    missing = length + 1 < expansion->numAcids &&
+      !isPeak(mass + PROTON_MASS) &&
+      !isPeak(expansion->totalMass - mass + WATER_MASS + PROTON_MASS);
+    if (numMissing + missing > maxMissing) continue;
+
+    expansion->counts[type]--;
+    expansion->sequence[length] = acidSymbols[type];
+    expandPrefix(expansion,length+1,mass,numMissing+missing,row);
+    expansion->counts[type]++;
+  }
+}
+/* The main routine. See the header for the usage */
+int main(int argc, char **argv)
+{
+  char *pName, *idName, *massName;
+  char fileName[128];
+  char line[MAX_LINE_SIZE];
+  char *next, *end;
+
+  int type, row, numExpanded = 0;
+  long numSequences = 0;
+
+  EXPANSION expansion;
+
+  FILE *fp;
+
+  /* Parse the options */
+  pName = argv[0]; argc--; argv++;
+  while (argc > 0 && argv[0][0] == '-') {
+    if (argc < 2) USAGE(pName);
+    if (!strcmp(argv[0],"-tolerance")) {
+      if (sscanf(argv[1],"%lf",&tolerance) != 1 || tolerance < 0.0)
+	USAGE(pName);
+    } else if (!strcmp(argv[0],"-max_missing")) {
+      if (sscanf(argv[1],"%d",&maxMissing) != 1 || maxMissing < 0)
+	USAGE(pName);
+    } else if (!strcmp(argv[0],"-max_sequences")) {
+      if (sscanf(argv[1],"%ld",&maxSequences) != 1 || maxSequences < 0)
+	USAGE(pName);
+    } else {
+      USAGE(pName);
+    }
+    argc -= 2; argv += 2;
+  }
+  if (argc != 3) USAGE(pName);
+  idName = argv[0];
+  massName = argv[1];
+
+  for (type=0;type<NUM_AMINO_ACID_TYPES;type++)
+    residueMasses[type] = acidMasses[type] - WATER_MASS;
+  readPeaks(argv[2]);
+
+  /* The longer of the two names is the one checked */
+  if (snprintf(fileName,sizeof(fileName),"Compositions-%s-%s.csv",idName,
+	       massName) >= (int)sizeof(fileName)) {
+    printf("ID and N make too long a file name: %s %s\n",idName,massName);
+    exit(1);
+  }
+  if ((fp = fopen(fileName,"r")) == NULL) {
+    printf("Unable to open file <%s>\n",fileName);
+    exit(1);
+  }
+  snprintf(fileName,sizeof(fileName),"Sequences-%s-%s.csv",idName,massName);
+  if ((outputFp = fopen(fileName,"w")) == NULL) {
+    printf("Unable to open file <%s>\n",fileName);
+    exit(1);
+  }
+  fprintf(outputFp,"Composition,Sequence,Matched\n");
+
+  /* Expand each composition as it is read */
+  for (row=1;fgets(line,sizeof(line),fp) != NULL;row++) {
+    memset(&expansion,0,sizeof(expansion));
+    next = line;
+    for (type=0;type<NUM_AMINO_ACID_TYPES;type++) {
+      expansion.counts[type] = strtol(next,&end,10);
+      if (end == next || *end != ',') break;
+      next = end + 1;
+      expansion.numAcids += expansion.counts[type];
+      expansion.totalMass += expansion.counts[type] * residueMasses[type];
+    }
+    if (type < NUM_AMINO_ACID_TYPES) {
+      printf("Composition %d is not counts of each acid, skipped\n",row);
+      continue;
+    }
+    if (expansion.numAcids == 0 || expansion.numAcids > MAX_SEQUENCE_SIZE) {
+      printf("Composition %d has %d acids, skipped\n",row,
+	     expansion.numAcids);
+      continue;
+    }
+
+    expandPrefix(&expansion,0,0.0,0,row);
+    numSequences += expansion.numSequences;
+    numExpanded++;
+    printf(" Composition %d: %ld sequences from %ld prefixes\n",row,
+	   expansion.numSequences,expansion.numPrefixes);
+  }
+  fclose(fp);
+  fclose(outputFp);
+
+  printf("%ld sequences from %d compositions against %d peaks\n",
+	 numSequences,numExpanded,numPeaks);
+  exit(0);
+}
@@ -13,13 +13,49 @@
  * circular buffer. It maintains indices to the first and last entries
  * for the window and the peak areas, incrementing them as necessary
  * as more points are read in.
+ *
+ * With the -centroid option, each peak mass is refined between the
+ * samples and printed with an estimate of its error, as mass:error,
+ * so that the composition search can use a window sized to match.
+ *
+ * With the -normalizer option the normalizer can instead be the
+ * median, or any quantile, of the two sides of the window taken
+ * together, so that a single noise spike beside a peak does not hide
+ * it. The points on the sides are kept in a pair of heaps split at
+ * the quantile, updated as the indices move, so this is still a
+ * single pass taking O(log w) per point.
+ *
+ * With the -resample option the whole spectrum is instead read in and
+ * interpolated onto a uniform grid of masses with the given step, so
+ * that the windows are fixed numbers of points and the maxima can be
+ * taken with a van Herk/Gil-Werman filter over contiguous arrays,
+ * using AVX (when compiled with -mavx2 or -march=native) for the
+ * part that vectorizes. Each peak found on the grid is mapped back to
+ * the largest of the original points next to it, so the masses
+ * printed are original masses as before, with nothing else on stdout.
+ * This is for dense spectra with far more points than the buffer could
+ * hold.
+ *
+ * With the -sweep option the window size, peak size and threshold
+ * come instead from a file with one setting to a line, as
+ * window,peak,threshold, and the peaks for all of them are found in
+ * one pass over the spectrum, each the same as a run with it alone
+ * would find. Each window and peak pair forms its normalizer once,
+ * with the maxima kept in queues rather than searched for, and all
+ * of its thresholds are applied to that. The peaks are printed as a
+ * CSV table, one line for each peak of each setting, with nothing else
+ * on stdout (what was swept goes to stderr).
  ************************************************************************
  */
 
 /* Includes */
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 /* File-Scope Constants, Macros, and Enumerations */
 
@@ -37,16 +73,88 @@
 /* This is the usage error */
 #define USAGE(pname) \
   {printf("Usage: %s <-window_size #> <-peak_size #> " \
-	  "<-threshold #> Filename\n",pname); exit(1);}
+	  "<-threshold #> <-centroid> <-normalizer max|median|#> " \
+	  "<-resample step> <-sweep settingsFile> Filename\n",pname); exit(1);}
+
+/* Which heap, if any, a point in the buffer is in */
+#define NOT_IN_HEAP (0)
+#define IN_LOW_HEAP (1)
+#define IN_HIGH_HEAP (2)
+
+/* The most settings a sweep can have */
+#define MAX_SETTINGS (256)
 
 /* File-Scope Type Definitions */
 
+/* 
+ * A heap of points (unwrapped indices) ordered by intensity: the
+ * largest on top if sign is 1, the smallest if it is -1
+ */
+typedef struct {
+  int sign;
+  int size;
+  int points[BUFFER_SIZE];
+} ORDER_HEAP;
+
+/* 
+ * A queue of points (indices) over a range whose ends only move up,
+ * holding the points that could still be its maximum: their
+ * intensities decrease from the head, which is the maximum
+ */
+typedef struct {
+  int head, tail, capacity;
+  int next;
+  int *points;
+} MAX_QUEUE;
+
+/* One setting of a sweep, and its window and peak pair */
+typedef struct {
+  float window_size, peak_size, threshold;
+  int pair;
+} SWEEP_SETTING;
+
 /* File-Scope Variables */
 static float masses[BUFFER_SIZE];
 static float intensities[BUFFER_SIZE];
 
+/* 
+ * The quantile of the sides of the window used as the normalizer, or
+ * 0 to use the maximum of each side as always
+ */
+static double quantile = 0.0;
+
+/* 
+ * The points on the sides of the window: the lowest quantile of them
+ * in lowHeap and the rest in highHeap, with where each point is
+ */
+static ORDER_HEAP lowHeap = {1, 0, {0}};
+static ORDER_HEAP highHeap = {-1, 0, {0}};
+static char heapWhich[BUFFER_SIZE];
+static int heapPosition[BUFFER_SIZE];
+
 /* File-Scope Function Prototypes */
 static float maxValue(float *input, int start, int end);
+static void centroidPeak(int start, int apex, int end,
+			 double *mass, double *error);
+static int heapAbove(ORDER_HEAP *heap, int first, int second);
+static void heapSet(ORDER_HEAP *heap, int position, int point);
+static void heapSift(ORDER_HEAP *heap, int position);
+static void heapInsert(ORDER_HEAP *heap, int point);
+static void heapRemove(ORDER_HEAP *heap, int point);
+static void quantileSet(int point, int inSides);
+static void quantileUpdate(int window_start, int peak_start,
+			   int peak_end, int window_end);
+static float quantileValue(void);
+static int readSpectrum(FILE *fp, float **allMasses, float **allIntensities);
+static void centroidInMemory(float *allMasses, float *allIntensities,
+			     int numPoints, int apex, float peak_size,
+			     double *mass, double *error);
+static void maxFilter(float *input, float *output, float *backward,
+		      int numPoints, int width);
+static float queueMax(MAX_QUEUE *queue, float *values, int start, int end);
+static void sweepPeaks(FILE *fp, char *sweepFileName, int centroid);
+static void findResampledPeaks(FILE *fp, float step, float window_size,
+			       float peak_size, float threshold, int centroid);
 
 static float maxValue(float *input, int start, int end)
 {
@@ -61,6 +169,761 @@ static float maxValue(float *input, int start, int end)
   return(max);
   
 }
+/*+F
+ ********************************************************
+ *
+ * centroidPeak - refine the mass of a peak between the samples
+ *
+ * This makes two estimates of where the peak really is. The first
+ * fits a parabola through the apex and its neighbours, to the log of
+ * the intensities if they are all positive (which is exact for a
+ * Gaussian peak) and to the intensities if not. The second is the
+ * intensity-weighted centroid of the points around the apex that are
+ * above half its intensity, within the peak limits.
+ *
+ * The refined mass is the first, and the error estimate is how much
+ * the two disagree, but never less than the spacing of the samples
+ * spread over the points in the centroid.
+ *
+ * Parameters:
+ *
+ * int start, apex, end - the peak limits and the apex (unwrapped indices)
+ * double *mass - the refined mass, returned
+ * double *error - the estimated error in that mass, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void centroidPeak(int start, int apex, int end,
+			 double *mass, double *error)
+{
+  int index, first, last;
+  double x0, x2, y0, y1, y2, a, b;
+  double sum, weightedSum, halfHeight, spacing, minError;
+
+  *mass = masses[INDEX(apex)];
+  *error = 0.0;
+  if (apex <= start || apex >= end) return;
+
+  /* 
+   * The parabola, with masses taken relative to the apex to keep the
+   * precision: y = a*x^2 + b*x + y1 through the three points
+   */
+  x0 = masses[INDEX(apex-1)] - masses[INDEX(apex)];
+  x2 = masses[INDEX(apex+1)] - masses[INDEX(apex)];
+  y0 = intensities[INDEX(apex-1)];
+  y1 = intensities[INDEX(apex)];
+  y2 = intensities[INDEX(apex+1)];
+  if (y0 > 0 && y1 > 0 && y2 > 0) {
+    y0 = log(y0); y1 = log(y1); y2 = log(y2);
+  }
+  a = ((y2 - y1) * x0 - (y0 - y1) * x2) / (x0 * x2 * (x2 - x0));
+  b = ((y0 - y1) * x2 * x2 - (y2 - y1) * x0 * x0) / (x0 * x2 * (x2 - x0));
+  if (a < 0) {
+    *mass += -b / (2 * a);
+    if (*mass < masses[INDEX(apex-1)]) *mass = masses[INDEX(apex-1)];
+    if (*mass > masses[INDEX(apex+1)]) *mass = masses[INDEX(apex+1)];
+  }
+
+  /* Now the centroid of the points above half height */
+  halfHeight = intensities[INDEX(apex)] / 2;
+  for (first = apex;
+       first > start && intensities[INDEX(first-1)] > halfHeight;
+       first--)
+    ;
+  for (last = apex;
+       last < end && intensities[INDEX(last+1)] > halfHeight;
+       last++)
+    ;
+  sum = weightedSum = 0.0;
+  for (index=first;index<=last;index++) {
+    sum += intensities[INDEX(index)];
+    weightedSum += intensities[INDEX(index)] *
+      (masses[INDEX(index)] - masses[INDEX(apex)]);
+  }
+
+  /* And from the two of them the error */
+  *error = fabs(*mass - (masses[INDEX(apex)] + weightedSum / sum));
+  spacing = (masses[INDEX(apex+1)] - masses[INDEX(apex-1)]) / 2;
+  minError = spacing / sqrt(12.0 * (last - first + 1));
+  if (*error < minError) *error = minError;
+}
+/*+F
+ ********************************************************
+ *
+ * heapAbove - whether one point belongs above another in a heap
+ *
+ * Returns: 1 if first belongs above second, 0 if not
+ ********************************************************
+ */
+static int heapAbove(ORDER_HEAP *heap, int first, int second)
+{
+  return(heap->sign * (intensities[INDEX(first)] -
+		       intensities[INDEX(second)]) > 0);
+}
+/*+F
+ ********************************************************
+ *
+ * heapSet - put a point at a position in a heap, and note it
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void heapSet(ORDER_HEAP *heap, int position, int point)
+{
+  heap->points[position] = point;
+  heapPosition[INDEX(point)] = position;
+}
+/*+F
+ ********************************************************
+ *
+ * heapSift - move the point at a position up or down to its place
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void heapSift(ORDER_HEAP *heap, int position)
+{
+  int point = heap->points[position];
+  int child;
+
+  /* Up, while it belongs above its parent */
+  while (position > 0 &&
+	 heapAbove(heap,point,heap->points[(position-1)/2])) {
+    heapSet(heap,position,heap->points[(position-1)/2]);
+    position = (position-1)/2;
+  }
+
+  /* Then down, while a child belongs above it */
+  while ((child = 2*position+1) < heap->size) {
+    if (child+1 < heap->size &&
+	heapAbove(heap,heap->points[child+1],heap->points[child]))
+      child++;
+    if (!heapAbove(heap,heap->points[child],point)) break;
+    heapSet(heap,position,heap->points[child]);
+    position = child;
+  }
+  heapSet(heap,position,point);
+}
+/*+F
+ ********************************************************
+ *
+ * heapInsert - add a point to a heap
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void heapInsert(ORDER_HEAP *heap, int point)
+{
+  heapSet(heap,heap->size++,point);
+  heapSift(heap,heap->size-1);
+}
+/*+F
+ ********************************************************
+ *
+ * heapRemove - take a point out of a heap, wherever it is
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void heapRemove(ORDER_HEAP *heap, int point)
+{
+  int position = heapPosition[INDEX(point)];
+
+  heap->size--;
+  if (position == heap->size) return;
+  heapSet(heap,position,heap->points[heap->size]);
+  heapSift(heap,position);
+}
+/*+F
+ ********************************************************
+ *
+ * quantileSet - add a point to the sides of the window or remove it
+ *
+ * The point goes into whichever heap it belongs in, and then the
+ * heaps are rebalanced so that the low one holds the lowest quantile
+ * of the points (and at least one), with the quantile on its top.
+ *
+ * Parameters:
+ *
+ * int point - the point (unwrapped index)
+ * int inSides - whether the point should now be on the sides
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void quantileSet(int point, int inSides)
+{
+  int numLow;
+
+  if (heapWhich[INDEX(point)] != NOT_IN_HEAP && !inSides) {
+    heapRemove(heapWhich[INDEX(point)] == IN_LOW_HEAP ?
+	       &lowHeap : &highHeap,point);
+    heapWhich[INDEX(point)] = NOT_IN_HEAP;
+  } else if (heapWhich[INDEX(point)] == NOT_IN_HEAP && inSides) {
+    if (lowHeap.size == 0 ||
+	intensities[INDEX(point)] <= intensities[INDEX(lowHeap.points[0])]) {
+      heapInsert(&lowHeap,point);
+      heapWhich[INDEX(point)] = IN_LOW_HEAP;
+    } else {
+      heapInsert(&highHeap,point);
+      heapWhich[INDEX(point)] = IN_HIGH_HEAP;
+    }
+  } else return;
+
+  /* Rebalance */
+  numLow = (int) ceil(quantile * (lowHeap.size + highHeap.size));
+  if (numLow < 1) numLow = 1;
+  while (lowHeap.size > numLow) {
+    point = lowHeap.points[0];
+    heapRemove(&lowHeap,point);
+    heapInsert(&highHeap,point);
+    heapWhich[INDEX(point)] = IN_HIGH_HEAP;
+  }
+  while (lowHeap.size < numLow && highHeap.size > 0) {
+    point = highHeap.points[0];
+    heapRemove(&highHeap,point);
+    heapInsert(&lowHeap,point);
+    heapWhich[INDEX(point)] = IN_LOW_HEAP;
+  }
+}
+/*+F
+ ********************************************************
+ *
+ * quantileUpdate - bring the sides of the window up to the indices
+ *
+ * The sides are the points from window_start to peak_start and from
+ * peak_end to window_end, as for the maximum. The indices only ever
+ * move up, so only the points they have passed since the last call
+ * can have come in or gone out, and each point is added and removed
+ * at most twice on its way through the window.
+ *
+ * Parameters:
+ *
+ * int window_start, peak_start, peak_end, window_end - the indices
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void quantileUpdate(int window_start, int peak_start,
+			   int peak_end, int window_end)
+{
+  static int last_window_start = -1;
+  static int last_peak_start, last_peak_end, last_window_end;
+  int point;
+
+#define IN_SIDES(x) \
+  (((x) >= window_start && (x) <= peak_start) || \
+   ((x) >= peak_end && (x) <= window_end))
+
+  /* The first time, everything in the window is new */
+  if (last_window_start < 0) {
+    for (point=window_start;point<=window_end;point++)
+      quantileSet(point,IN_SIDES(point));
+  } else {
+    for (point=last_window_start;point<window_start;point++)
+      quantileSet(point,IN_SIDES(point));
+    for (point=last_peak_start+1;point<=peak_start;point++)
+      quantileSet(point,IN_SIDES(point));
+    for (point=last_peak_end;point<peak_end;point++)
+      quantileSet(point,IN_SIDES(point));
+    for (point=last_window_end+1;point<=window_end;point++)
+      quantileSet(point,IN_SIDES(point));
+  }
+
+#undef IN_SIDES
+
+  last_window_start = window_start;
+  last_peak_start = peak_start;
+  last_peak_end = peak_end;
+  last_window_end = window_end;
+}
+/*+F
+ ********************************************************
+ *
+ * quantileValue - the quantile of the sides of the window
+ *
+ * Returns: the intensity at the quantile
+ ********************************************************
+ */
+static float quantileValue(void)
+{
+  return(intensities[INDEX(lowHeap.points[0])]);
+}
+/*+F
+ ********************************************************
+ *
+ * readSpectrum - read the rest of a spectrum file into memory
+ *
+ * Parameters:
+ *
+ * FILE *fp - the file, with the header already read
+ * float **allMasses, **allIntensities - the points, allocated here
+ *
+ * Returns: the number of points read, in increasing order of mass
+ ********************************************************
+ */
+static int readSpectrum(FILE *fp, float **allMasses, float **allIntensities)
+{
+  char line[128];
+  int numPoints = 0, maxPoints = 0;
+
+  *allMasses = *allIntensities = NULL;
+  while (fgets(line,sizeof(line),fp) != NULL) {
+    if (numPoints == maxPoints) {
+      maxPoints = maxPoints > 0 ? 2 * maxPoints : 65536;
+      if ((*allMasses = realloc(*allMasses,
+				maxPoints * sizeof(float))) == NULL ||
+	  (*allIntensities = realloc(*allIntensities,
+				     maxPoints * sizeof(float))) == NULL) {
+	printf("Unable to allocate %d points\n",maxPoints);
+	exit(1);
+      }
+    }
+    if (sscanf(line,"%f,%f",*allMasses+numPoints,
+	       *allIntensities+numPoints) != 2) break;
+
+    /* The grid needs the masses in order, so skip any that are not */
+    if (numPoints > 0 &&
+	(*allMasses)[numPoints] <= (*allMasses)[numPoints-1]) continue;
+    numPoints++;
+  }
+
+  return(numPoints);
+}
+/*+F
+ ********************************************************
+ *
+ * centroidInMemory - centroidPeak for a spectrum read into memory
+ *
+ * This loads the points within half a peak of the apex into the
+ * buffer, where centroidPeak wants them, and refines the peak there.
+ *
+ * Parameters:
+ *
+ * float *allMasses, *allIntensities - the points
+ * int numPoints, apex - the number of points and the peak
+ * float peak_size - the width of the peak area
+ * double *mass, *error - as for centroidPeak, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void centroidInMemory(float *allMasses, float *allIntensities,
+			     int numPoints, int apex, float peak_size,
+			     double *mass, double *error)
+{
+  int start, end, point;
+
+  for (start=apex;
+       start > 0 && apex - start < BUFFER_SIZE/2 - 1 &&
+	 allMasses[apex] - allMasses[start] < peak_size/2;
+       start--)
+    ;
+  for (end=apex;
+       end < numPoints-1 && end - apex < BUFFER_SIZE/2 - 1 &&
+	 allMasses[end] - allMasses[apex] < peak_size/2;
+       end++)
+    ;
+  for (point=start;point<=end;point++) {
+    masses[INDEX(point)] = allMasses[point];
+    intensities[INDEX(point)] = allIntensities[point];
+  }
+  centroidPeak(start,apex,end,mass,error);
+}
+/*+F
+ ********************************************************
+ *
+ * maxFilter - the maximum of every run of width points
+ *
+ * This is the van Herk/Gil-Werman filter: the input is split into
+ * blocks of width points, and the maxima are taken forwards from the
+ * start of each block and backwards from its end. Any run of width
+ * points then spans at most two blocks, so its maximum is the larger
+ * of the backward maximum at its start and the forward maximum at its
+ * end: three comparisons a point, whatever the width. The last step
+ * is the same for every point and is done 8 at a time with AVX.
+ *
+ * Parameters:
+ *
+ * float *input - the points
+ * float *output - the maximum of input[i] to input[i+width-1] for i
+ *                 up to numPoints-width, returned
+ * float *backward - workspace for numPoints points
+ * int numPoints, width - the number of points and the width of a run
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void maxFilter(float *input, float *output, float *backward,
+		      int numPoints, int width)
+{
+  int block, last, index;
+
+  /* The forward maxima go into the output, and are replaced in order */
+  for (block=0;block<numPoints;block+=width) {
+    last = block + width < numPoints ? block + width : numPoints;
+    output[block] = input[block];
+    for (index=block+1;index<last;index++)
+      output[index] = input[index] > output[index-1] ?
+	input[index] : output[index-1];
+    backward[last-1] = input[last-1];
+    for (index=last-2;index>=block;index--)
+      backward[index] = input[index] > backward[index+1] ?
+	input[index] : backward[index+1];
+  }
+
+  index = 0;
+#ifdef __AVX__
+  for (;index+8<=numPoints-width+1;index+=8)
+    _mm256_storeu_ps(output+index,
+		     _mm256_max_ps(_mm256_loadu_ps(backward+index),
+				   _mm256_loadu_ps(output+index+width-1)));
+#endif
+  for (;index<=numPoints-width;index++)
+    output[index] = backward[index] > output[index+width-1] ?
+      backward[index] : output[index+width-1];
+}
+/*+F
+ ********************************************************
+ *
+ * findResampledPeaks - find the peaks on a uniform grid of masses
+ *
+ * The tests are the ones made point by point in main, with the window
+ * and peak limits at fixed offsets around each grid point: the point
+ * must be above threshold times the maximum of each side of the
+ * window, and the maximum of the peak area. Each grid peak is then
+ * moved to the largest original point within a step of it.
+ *
+ * Parameters:
+ *
+ * FILE *fp - the spectrum file, with the header already read
+ * float step - the spacing of the grid
+ * float window_size, peak_size, threshold - as for main
+ * int centroid - whether to refine the masses of the peaks
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void findResampledPeaks(FILE *fp, float step, float window_size,
+			       float peak_size, float threshold, int centroid)
+{
+  float *allMasses, *allIntensities;
+  float *grid, *sideMax, *peakMax, *backward;
+  int numPoints, numGrid, windowHalf, peakHalf;
+  int index, point, apex, lastApex, end;
+  double mass, peak_mass, peak_error;
+
+  numPoints = readSpectrum(fp,&allMasses,&allIntensities);
+  if (numPoints < 2) {
+    printf("\n");
+    return;
+  }
+
+  windowHalf = (int) (window_size / 2 / step + 0.5);
+  peakHalf = (int) (peak_size / 2 / step + 0.5);
+  if (peakHalf < 1) peakHalf = 1;
+  if (windowHalf <= peakHalf) {
+    printf("The window must be wider than the peak on the grid\n");
+    exit(1);
+  }
+  fprintf(stderr," Resampled %d points, window %d peak %d\n",
+	  numPoints,windowHalf,peakHalf);
+
+  numGrid = (int) ((allMasses[numPoints-1] - allMasses[0]) / step) + 1;
+  if ((grid = malloc(numGrid * sizeof(float))) == NULL ||
+      (sideMax = malloc(numGrid * sizeof(float))) == NULL ||
+      (peakMax = malloc(numGrid * sizeof(float))) == NULL ||
+      (backward = malloc(numGrid * sizeof(float))) == NULL) {
+    printf("Unable to allocate a grid of %d points\n",numGrid);
+    exit(1);
+  }
+
+  /* Interpolate onto the grid */
+  for (index=0,point=0;index<numGrid;index++) {
+    mass = allMasses[0] + (double) index * step;
+    while (point < numPoints-2 && allMasses[point+1] < mass) point++;
+    grid[index] = allIntensities[point] +
+      (allIntensities[point+1] - allIntensities[point]) *
+      (mass - allMasses[point]) / (allMasses[point+1] - allMasses[point]);
+  }
+
+  /* The maxima of the sides and of the peak area */
+  maxFilter(grid,sideMax,backward,numGrid,windowHalf-peakHalf+1);
+  maxFilter(grid,peakMax,backward,numGrid,2*peakHalf+1);
+
+  for (index=windowHalf,point=0,lastApex=-1;
+       index<numGrid-windowHalf;index++) {
+    if (!(grid[index] > threshold * sideMax[index-windowHalf] &&
+	  grid[index] > threshold * sideMax[index+peakHalf] &&
+	  grid[index] == peakMax[index-peakHalf]))
+      continue;
+
+    /* Map back to the largest original point near the grid point */
+    mass = allMasses[0] + (double) index * step;
+    while (point < numPoints-1 && allMasses[point+1] <= mass - step) point++;
+    for (apex=point,end=point;
+	 end < numPoints && allMasses[end] <= mass + step;end++)
+      if (allIntensities[end] > allIntensities[apex]) apex = end;
+    if (apex == lastApex) continue;
+    lastApex = apex;
+
+    if (centroid) {
+      centroidInMemory(allMasses,allIntensities,numPoints,apex,peak_size,
+		       &peak_mass,&peak_error);
+      printf("%.6f:%.6f ",peak_mass,peak_error);
+    } else {
+      printf("%.6f ",allMasses[apex]);
+    }
+  }
+  printf("\n");
+
+  free(grid); free(sideMax); free(peakMax); free(backward);
+  free(allMasses); free(allIntensities);
+}
+/*+F
+ ********************************************************
+ *
+ * queueMax - move a queue up to a range and return its maximum
+ *
+ * Parameters:
+ *
+ * MAX_QUEUE *queue - the queue
+ * float *values - the intensities
+ * int start, end - the range, no lower than the last time
+ *
+ * Returns: the maximum from start to end, or the value at start if
+ *          the range is empty, as maxValue gives
+ ********************************************************
+ */
+static float queueMax(MAX_QUEUE *queue, float *values, int start, int end)
+{
+  int index, size;
+  int *points;
+
+  /* Add the new points, dropping those they are bigger than */
+  for (;queue->next<=end;queue->next++) {
+    while (queue->tail > queue->head &&
+	   values[queue->points[(queue->tail-1) % queue->capacity]] <=
+	   values[queue->next])
+      queue->tail--;
+
+    /* Make more room if we need it, keeping the points in order */
+    if (queue->tail - queue->head == queue->capacity) {
+      size = queue->capacity;
+      if ((points = malloc((size > 0 ? 2 * size : 256) *
+			   sizeof(int))) == NULL) {
+	printf("Unable to allocate a queue of %d points\n",2 * size);
+	exit(1);
+      }
+      for (index=0;index<size;index++)
+	points[index] = queue->points[(queue->head + index) % size];
+      free(queue->points);
+      queue->points = points;
+      queue->capacity = size > 0 ? 2 * size : 256;
+      queue->head = 0;
+      queue->tail = size;
+    }
+    queue->points[queue->tail++ % queue->capacity] = queue->next;
+  }
+
+  /* And take off the ones that are now below the start */
+  while (queue->tail > queue->head &&
+	 queue->points[queue->head % queue->capacity] < start)
+    queue->head++;
+
+  /* An empty range gives its start, as maxValue does */
+  if (start > end || queue->tail == queue->head) return(values[start]);
+  return(values[queue->points[queue->head % queue->capacity]]);
+}
+/*+F
+ ********************************************************
+ *
+ * sweepPeaks - find the peaks for many settings in one pass
+ *
+ * This moves the same limits as main, the same way, so that each
+ * setting finds exactly the peaks a run with it alone would, but it
+ * moves them all in one pass over the spectrum. The window limits
+ * are kept once for each window size and the peak limits once for
+ * each window and peak pair (which is also where the normalizer is
+ * formed), with the maximum of each side and of the peak area kept
+ * by a queue that only ever moves up. The thresholds are then just
+ * comparisons against the pair's normalizer.
+ *
+ * Parameters:
+ *
+ * FILE *fp - the spectrum file, with the header already read
+ * char *sweepFileName - the file of settings
+ * int centroid - whether to refine the masses of the peaks
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void sweepPeaks(FILE *fp, char *sweepFileName, int centroid)
+{
+  char line[128];
+  float *allMasses, *allIntensities;
+  float windowSizes[MAX_SETTINGS];
+  float leftMax, rightMax, peakMax, value;
+  int windowStart[MAX_SETTINGS], windowEnd[MAX_SETTINGS];
+  int firstPoint[MAX_SETTINGS], windowDone[MAX_SETTINGS];
+  int pairWindow[MAX_SETTINGS], peakStart[MAX_SETTINGS];
+  int peakEnd[MAX_SETTINGS], isPeak[MAX_SETTINGS];
+  float pairPeak[MAX_SETTINGS], normalizer[MAX_SETTINGS];
+  int numSettings, numWindows, numPairs, numPoints;
+  int index, window, pair, point;
+  double peak_mass, peak_error;
+  MAX_QUEUE *queues;
+  SWEEP_SETTING settings[MAX_SETTINGS];
+  FILE *sweepFp;
+
+  /* Read the settings, skipping any line that isn't one */
+  if ((sweepFp = fopen(sweepFileName,"r")) == NULL) {
+    printf("Unable to open file <%s>\n",sweepFileName);
+    exit(1);
+  }
+  numSettings = 0;
+  while (fgets(line,sizeof(line),sweepFp) != NULL) {
+    if (sscanf(line,"%f,%f,%f",&settings[numSettings].window_size,
+	       &settings[numSettings].peak_size,
+	       &settings[numSettings].threshold) != 3) continue;
+    if (settings[numSettings].peak_size <= 0 ||
+	settings[numSettings].window_size <=
+	settings[numSettings].peak_size) {
+      printf("The window must be wider than the peak: %s",line);
+      exit(1);
+    }
+    if (++numSettings == MAX_SETTINGS) break;
+  }
+  fclose(sweepFp);
+  if (numSettings == 0) {
+    printf("No settings found in <%s>\n",sweepFileName);
+    exit(1);
+  }
+
+  /* Find the distinct window sizes and window and peak pairs */
+  numWindows = numPairs = 0;
+  for (index=0;index<numSettings;index++) {
+    for (window=0;window<numWindows;window++)
+      if (windowSizes[window] == settings[index].window_size) break;
+    if (window == numWindows)
+      windowSizes[numWindows++] = settings[index].window_size;
+    for (pair=0;pair<numPairs;pair++)
+      if (pairWindow[pair] == window &&
+	  pairPeak[pair] == settings[index].peak_size) break;
+    if (pair == numPairs) {
+      pairWindow[numPairs] = window;
+      pairPeak[numPairs++] = settings[index].peak_size;
+    }
+    settings[index].pair = pair;
+  }
+  fprintf(stderr," Sweep of %d settings, %d windows, %d pairs\n",
+	  numSettings,numWindows,numPairs);
+
+  numPoints = readSpectrum(fp,&allMasses,&allIntensities);
+  if ((queues = calloc(3*numPairs,sizeof(MAX_QUEUE))) == NULL) {
+    printf("Unable to allocate %d queues\n",3*numPairs);
+    exit(1);
+  }
+
+  /* 
+   * Set each window up as main does once it is fully realized: the
+   * first point is half a window in, and the end is far enough past
+   * it. The first line after that is where the points start.
+   */
+  for (window=0;window<numWindows;window++) {
+    windowStart[window] = 0;
+    windowDone[window] = 1;
+    for (point=0;
+	 point < numPoints &&
+	   allMasses[point] < allMasses[0] + windowSizes[window]/2;
+	 point++)
+      ;
+    firstPoint[window] = point;
+    for (index=point;
+	 index < numPoints &&
+	   (allMasses[index] - allMasses[0] <= windowSizes[window] ||
+	    allMasses[index] - allMasses[point] < windowSizes[window]/2);
+	 index++)
+      ;
+    windowEnd[window] = index + 1;
+    if (windowEnd[window] < numPoints) windowDone[window] = 0;
+  }
+  for (pair=0;pair<numPairs;pair++) {
+    point = firstPoint[pairWindow[pair]];
+    for (peakStart[pair] = point;
+	 peakStart[pair] > 0 &&
+	   allMasses[point] - allMasses[peakStart[pair]] < pairPeak[pair]/2;
+	 peakStart[pair]--)
+      ;
+    peakEnd[pair] = point;
+  }
+
+  printf("Setting,WindowSize,PeakSize,Threshold,Mass%s\n",
+	 centroid ? ",Error" : "");
+  for (point=0;point<numPoints-1;point++) {
+
+    /* Move the windows up, as each new line would in main */
+    for (window=0;window<numWindows;window++) {
+      if (windowDone[window] || point < firstPoint[window]) continue;
+      while (windowEnd[window] < numPoints &&
+	     allMasses[windowEnd[window]] - allMasses[point+1] <=
+	     windowSizes[window]/2)
+	windowEnd[window]++;
+      if (windowEnd[window] == numPoints) {
+	windowDone[window] = 1;
+	continue;
+      }
+      while (allMasses[windowEnd[window]] -
+	     allMasses[windowStart[window]+2] > windowSizes[window])
+	windowStart[window]++;
+    }
+
+    /* Then the peaks, and the normalizer of each pair */
+    value = allIntensities[point];
+    for (pair=0;pair<numPairs;pair++) {
+      window = pairWindow[pair];
+      isPeak[pair] = 0;
+      if (windowDone[window] || point < firstPoint[window]) continue;
+      while (allMasses[point] - allMasses[peakStart[pair]+2] >
+	     pairPeak[pair]/2)
+	peakStart[pair]++;
+      while (allMasses[peakEnd[pair]] - allMasses[point] < pairPeak[pair]/2)
+	peakEnd[pair]++;
+
+      leftMax = queueMax(queues+3*pair,allIntensities,
+			 windowStart[window],peakStart[pair]);
+      peakMax = queueMax(queues+3*pair+1,allIntensities,
+			 peakStart[pair],peakEnd[pair]);
+      rightMax = queueMax(queues+3*pair+2,allIntensities,
+			  peakEnd[pair],windowEnd[window]);
+      isPeak[pair] = value == peakMax;
+      normalizer[pair] = leftMax > rightMax ? leftMax : rightMax;
+    }
+
+    /* And now the thresholds */
+    for (index=0;index<numSettings;index++) {
+      pair = settings[index].pair;
+      if (!isPeak[pair] ||
+	  value <= settings[index].threshold * normalizer[pair])
+	continue;
+      printf("%d,%g,%g,%g,",index+1,settings[index].window_size,
+	     settings[index].peak_size,settings[index].threshold);
+      if (centroid) {
+	centroidInMemory(allMasses,allIntensities,numPoints,point,
+			 settings[index].peak_size,&peak_mass,&peak_error);
+	printf("%.6f,%.6f\n",peak_mass,peak_error);
+      } else {
+	printf("%.6f\n",allMasses[point]);
+      }
+    }
+  }
+
+  for (index=0;index<3*numPairs;index++)
+    free(queues[index].points);
+  free(queues);
+  free(allMasses); free(allIntensities);
+}
 int main(int argc, char **argv)
 {
   char *pname;
@@ -75,8 +938,16 @@ int main(int argc, char **argv)
   int peak_end = 0;
   int window_end = 0;
 
+  int centroid = 0;
+
   float threshold=5.0;
 
+  float step = 0.0;
+
+  char *sweepFileName = NULL;
+
+  double peak_mass, peak_error;
+
   float peak_size=8;
   float window_size = 16.0;
 
@@ -93,7 +964,7 @@ int main(int argc, char **argv)
   while (argc > 1) {
 
     /* Check for window width */
-    if (strcmp(argv[0],"-window_size")) {
+    if (!strcmp(argv[0],"-window_size")) {
       argc--; argv++;
       if (argc == 0 || sscanf(argv[0],"%f",&window_size) != 1)
 	USAGE(pname);
@@ -102,7 +973,7 @@ int main(int argc, char **argv)
     }
 
     /* Check for peak width */
-    if (strcmp(argv[0],"-peak_size")) {
+    if (!strcmp(argv[0],"-peak_size")) {
       argc--; argv++;
       if (argc == 0 || sscanf(argv[0],"%f",&peak_size) != 1)
 	USAGE(pname);
@@ -110,7 +981,7 @@ int main(int argc, char **argv)
       continue;
     }
     /* And the threshold */
-    if (strcmp(argv[0],"-threshold")) {
+    if (!strcmp(argv[0],"-threshold")) {
       argc--; argv++;
       if (argc == 0 || sscanf(argv[0],"%f",&threshold) != 1)
 	USAGE(pname);
@@ -118,14 +989,52 @@ int main(int argc, char **argv)
       continue;
     }
 
+    /* Whether to refine the peak masses */
+    if (!strcmp(argv[0],"-centroid")) {
+      centroid = 1;
+      argc--; argv++;
+      continue;
+    }
+
+    /* And the normalizer */
+    if (!strcmp(argv[0],"-normalizer")) {
+      argc--; argv++;
+      if (argc == 0) USAGE(pname);
+      if (!strcmp(argv[0],"max"))
+	quantile = 0.0;
+      else if (!strcmp(argv[0],"median"))
+	quantile = 0.5;
+      else if (sscanf(argv[0],"%lf",&quantile) != 1 ||
+	       quantile <= 0.0 || quantile > 1.0)
+	USAGE(pname);
+      argc--; argv++;
+      continue;
+    }
+
+    /* Whether to resample onto a grid first */
+    if (!strcmp(argv[0],"-resample")) {
+      argc--; argv++;
+      if (argc == 0 || sscanf(argv[0],"%f",&step) != 1 || step <= 0.0)
+	USAGE(pname);
+      argc--; argv++;
+      continue;
+    }
+
+    /* Or to sweep through a file of settings */
+    if (!strcmp(argv[0],"-sweep")) {
+      argc--; argv++;
+      if (argc == 0) USAGE(pname);
+      sweepFileName = argv[0];
+      argc--; argv++;
+      continue;
+    }
+
     /* IF we got hear, there was a bad command line argument */
     USAGE(pname);
   }
 
   peak_half_size = peak_size/2;
   window_half_size = window_size/2;
-  DPRINTF((" Detection %.1f %.1f %.1f\n",window_size,peak_size,threshold));
-  
   /* Now open the file and get the first line */
   if ((fp = fopen(argv[0],"r")) == NULL ||
       fgets(line,sizeof(line),fp) == NULL) {
@@ -133,6 +1042,25 @@ int main(int argc, char **argv)
     exit(1);
   }
 
+  /* The sweep finds the peaks for its own settings */
+  if (sweepFileName != NULL) {
+    sweepPeaks(fp,sweepFileName,centroid);
+    fclose(fp);
+    exit(0);
+  }
+
+  /* The grid only has the maximum normalizer */
+  if (step > 0.0) {
+    if (quantile > 0.0) {
+      printf("The quantile normalizer can't be used with -resample\n");
+      exit(1);
+    }
+    findResampledPeaks(fp,step,window_size,peak_size,threshold,centroid);
+    fclose(fp);
+    exit(0);
+  }
+  DPRINTF((" Detection %.1f %.1f %.1f\n",window_size,peak_size,threshold));
+
   while(1) {
     if (fgets(line,sizeof(line),fp) == NULL ||
 	sscanf(line,"%f,%f",
@@ -215,14 +1143,27 @@ int main(int argc, char **argv)
 		 maxValue(intensities,peak_start, peak_end),
 		 maxValue(intensities,peak_end, window_end),
 		 intensities[INDEX(current_point)]));
-	if (intensities[INDEX(current_point)] >
-	    threshold * maxValue(intensities,window_start, peak_start) &&
+	if (quantile > 0.0)
+	  quantileUpdate(window_start,peak_start,peak_end,window_end);
+	if ((quantile > 0.0 ?
+	     intensities[INDEX(current_point)] >
+	     threshold * quantileValue() :
+
+	     intensities[INDEX(current_point)] >
+	     threshold * maxValue(intensities,window_start, peak_start) &&
 
-	    intensities[INDEX(current_point)] >
-	    threshold * maxValue(intensities,peak_end,window_end) &&
+	     intensities[INDEX(current_point)] >
+	     threshold * maxValue(intensities,peak_end,window_end)) &&
 	    intensities[INDEX(current_point)] ==
-	    maxValue(intensities,peak_start,peak_end))
-	  printf("%.6f ",masses[INDEX(current_point)]);
+	    maxValue(intensities,peak_start,peak_end)) {
+	  if (centroid) {
+	    centroidPeak(peak_start,current_point,peak_end,
+			 &peak_mass,&peak_error);
+	    printf("%.6f:%.6f ",peak_mass,peak_error);
+	  } else {
+	    printf("%.6f ",masses[INDEX(current_point)]);
+	  }
+	}
 	DPRINTF(("\n"));
 	current_point++;
       }
@@ -0,0 +1,1027 @@
+/*+C
+ ******************************************************************
+ * This program watches the data directory for mass specs as they
+ * land and analyzes each one as soon as it is complete, rather than
+ * waiting for a web request to run the analysis and holding that
+ * request open until it is done.
+ *
+ * Usage: ingestMassSpec <options>
+ *
+ * where options are any of:
+ *
+ *   -data dir     : the directory to watch (./mic-data)
+ *   -output dir   : the directory the results go in (./mic-output)
+ *   -script file  : the analysis script (./analyzeMassSpec.R)
+ *   -workers #    : the most analyses to run at once (2)
+ *   -metrics file : keep the service's metrics in this file
+ *
+ * A file named ID-data.csv, as the upload page names them, is
+ * checked and analyzed under that ID. Any other .csv file, as from an
+ * instrument PC dropping its exports straight into the directory, is
+ * checked and converted into the form analyzeMassSpec.R reads, under
+ * a new ID, and written as ID-data.csv, which then lands in turn.
+ * Files are only picked up once closed after writing or moved in, so
+ * a partial file is never read. Files that are not a two column mass
+ * spec (such as the plates the MIC page also puts in the directory)
+ * are left alone. An ID-data.csv whose ID is anything but letters,
+ * digits, '_' and '-' is rejected, as the ID goes on to a command line.
+ *
+ * The analyses are run by a fixed pool of workers from a bounded
+ * queue, so a burst of uploads is worked through a few at a time.
+ * Each runs Rscript in a directory of its own inside the output
+ * directory and, once it is done, its files are renamed into the
+ * output directory with the plot last, so the page never sees half a
+ * result. Until then Status-ID.txt in the output directory says
+ * where the analysis is: the script is given the output directory
+ * for it, so the composition search keeps its progress there as it
+ * goes.
+ *
+ * With -metrics, the file is rewritten (atomically) whenever a file
+ * is queued or an analysis starts or finishes, in the Prometheus text
+ * format, for a collector to read. It holds histograms of the time
+ * files wait in the queue, are checked or converted, are analyzed,
+ * spend in each stage of the analysis (from the Timing-ID.csv it
+ * writes) and the CPU time they use; the jobs running, the queue
+ * depth and the largest memory an analysis has used; and counts of
+ * the jobs done, failed, ignored and rejected and of the combinations the
+ * composition searches tried (from the Metrics-ID.prom they write).
+ * None of it is more than a few sums per job.
+ *
+ * This uses inotify, so is Linux only.
+ ******************************************************************
+ */
+
+/* Includes */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <pthread.h>
+
+/* File-Scope Constants, Macros, and Enumerations */
+
+/* This is the most files that can be waiting for a worker */
+#define MAX_QUEUE (256)
+
+/* This is the fewest points a mass spec can have to be analyzed */
+#define MIN_POINTS (100)
+
+/*
+ * This is how many header lines analyzeMassSpec.R skips, and so how
+ * many a converted file is given
+ */
+#define HEADER_LINES (5)
+
+/* This is the suffix of the files named as the upload page does */
+#define DATA_SUFFIX "-data.csv"
+
+/* These are the upper bounds of the histogram buckets, in seconds */
+#define NUM_BUCKETS (10)
+#define BUCKET_BOUNDS {0.01,0.05,0.1,0.5,1.0,5.0,10.0,30.0,60.0,300.0}
+
+/* This is the most analysis stages that are kept apart */
+#define MAX_STAGES (8)
+
+/* This is the usage error */
+#define USAGE(pname) \
+  {printf("Usage: %s <-data dir> <-output dir> <-script file> " \
+	  "<-workers #> <-metrics file>\n",pname); exit(1);}
+
+/* File-Scope Type Definitions */
+
+/* A file waiting for a worker, and since when */
+typedef struct {
+  char name[NAME_MAX+1];
+  double queued;
+} INGEST_JOB;
+
+/* A histogram of times, with the number at or below each bound */
+typedef struct {
+  char label[64];
+  long counts[NUM_BUCKETS];
+  long count;
+  double sum;
+} HISTOGRAM;
+
+/* File-Scope Variables */
+
+/* The directories and script, as absolute paths, and the pool size */
+static char dataDir[PATH_MAX];
+static char outputDir[PATH_MAX];
+static char scriptName[PATH_MAX];
+static int numWorkers = 2;
+
+/*
+ * The queue of files waiting for a worker, as a ring, and whether we
+ * are shutting down. All are mutex protected.
+ */
+static INGEST_JOB jobQueue[MAX_QUEUE];
+static int queueHead = 0;
+static int queueSize = 0;
+static int shuttingDown = 0;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queueNotFull = PTHREAD_COND_INITIALIZER;
+
+/* This is used to give converted files IDs no one else has */
+static int numConverted = 0;
+static pthread_mutex_t idMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The metrics, and where they are written, if anywhere. All are
+ * mutex protected. A queue lock, if needed, is taken first.
+ */
+static char *metricsFileName = NULL;
+static HISTOGRAM queueWait, checkTime, analysisTime, jobCpu;
+static HISTOGRAM stageTimes[MAX_STAGES];
+static int numStages = 0;
+static int jobsRunning = 0;
+static int queueDepth = 0;
+static long maxRss = 0;
+static long jobsDone = 0;
+static long jobsFailed = 0;
+static long jobsIgnored = 0;
+static long jobsRejected = 0;
+static long nodesSearched = 0;
+static pthread_mutex_t metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set by the signal handler to stop watching */
+static volatile sig_atomic_t stopWatching = 0;
+
+/* File-Scope Prototypes */
+static void logMessage(char *format, ...);
+static int formatPath(char *path, size_t size, char *format, ...);
+static double secondsNow(void);
+static void observeTime(HISTOGRAM *histogram, double seconds);
+static void observeStages(char *workDir, char *id);
+static void writeHistogram(FILE *fp, char *name, char *help,
+			   HISTOGRAM *histograms, int numHistograms);
+static void writeMetrics(void);
+static void catchSignal(int signalNumber);
+static int queueJob(char *name);
+static int nextJob(INGEST_JOB *job);
+static void *runWorker(void *vUnused);
+static int validId(char *id);
+static int readPoint(char *line, double *mass, double *intensity);
+static int checkSpectrum(char *fileName, FILE *convertFp);
+static void convertSpectrum(char *name);
+static void writeStatus(char *id, char *status);
+static void analyzeSpectrum(char *id);
+static void publishResults(char *workDir, char *id);
+
+/*+F
+ ********************************************************
+ *
+ * logMessage - print a time stamped line, as printf
+ *
+ * The line is formed first and printed whole, so that the workers'
+ * lines do not run into each other.
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void logMessage(char *format, ...)
+{
+  char line[2*PATH_MAX];
+  size_t length;
+  time_t now = time(NULL);
+  struct tm localNow;
+  va_list arguments;
+
+  length = strftime(line,sizeof(line),"%Y-%m-%d %H:%M:%S ",
+		    localtime_r(&now,&localNow));
+  va_start(arguments,format);
+  vsnprintf(line+length,sizeof(line)-length,format,arguments);
+  va_end(arguments);
+  printf("%s\n",line);
+  fflush(stdout);
+}
+/*+F
+ ********************************************************
+ *
+ * formatPath - form a path, as snprintf, checking that it fits
+ *
+ * A path that does not fit is logged, and must not be used.
+ *
+ * Parameters:
+ *
+ * char *path - the path, returned
+ * size_t size - the size of path
+ * char *format, ... - as for printf
+ *
+ * Returns: 1 if it fits, 0 if not
+ ********************************************************
+ */
+static int formatPath(char *path, size_t size, char *format, ...)
+{
+  int length;
+  va_list arguments;
+
+  va_start(arguments,format);
+  length = vsnprintf(path,size,format,arguments);
+  va_end(arguments);
+  if (length < 0 || (size_t)length >= size) {
+    logMessage("Path too long: %s...",path);
+    return(0);
+  }
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * secondsNow - the time, in seconds from some fixed point
+ *
+ * Returns: the time
+ ********************************************************
+ */
+static double secondsNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return(now.tv_sec + 1e-9*now.tv_nsec);
+}
+/*+F
+ ********************************************************
+ *
+ * observeTime - add a time to a histogram
+ *
+ * The metrics lock must be held.
+ *
+ * Parameters:
+ *
+ * HISTOGRAM *histogram - the histogram
+ * double seconds - the time
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void observeTime(HISTOGRAM *histogram, double seconds)
+{
+  static double bounds[NUM_BUCKETS] = BUCKET_BOUNDS;
+  int bucket;
+
+  for (bucket=0;bucket<NUM_BUCKETS;bucket++)
+    if (seconds <= bounds[bucket]) histogram->counts[bucket]++;
+  histogram->count++;
+  histogram->sum += seconds;
+}
+/*+F
+ ********************************************************
+ *
+ * observeStages - add what an analysis says about itself
+ *
+ * The stage times are read from Timing-ID.csv, a line of stage and
+ * seconds after a header, and the combinations searched from the
+ * peptide_search_nodes lines of Metrics-ID.prom. Either may be
+ * missing, as when no peaks were found. The metrics lock must be held.
+ *
+ * Parameters:
+ *
+ * char *workDir - the directory the analysis ran in
+ * char *id - the ID
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void observeStages(char *workDir, char *id)
+{
+  char fileName[PATH_MAX+NAME_MAX+2];
+  char line[256];
+  char stage[32];
+  double seconds, nodes;
+  int index;
+  FILE *fp;
+
+  if (formatPath(fileName,sizeof(fileName),"%s/Timing-%s.csv",workDir,id) &&
+      (fp = fopen(fileName,"r")) != NULL) {
+    while (fgets(line,sizeof(line),fp) != NULL) {
+      if (sscanf(line,"%31[^,],%lf",stage,&seconds) != 2) continue;
+      for (index=0;index<numStages;index++)
+	if (!strcmp(stageTimes[index].label,stage)) break;
+      if (index == numStages) {
+	if (numStages == MAX_STAGES) continue;
+	strcpy(stageTimes[numStages++].label,stage);
+      }
+      observeTime(&stageTimes[index],seconds);
+    }
+    fclose(fp);
+  }
+
+  if (formatPath(fileName,sizeof(fileName),"%s/Metrics-%s.prom",workDir,id) &&
+      (fp = fopen(fileName,"r")) != NULL) {
+    while (fgets(line,sizeof(line),fp) != NULL) {
+      if (strncmp(line,"peptide_search_nodes{",21)) continue;
+      if (sscanf(strchr(line,'}')+1,"%lf",&nodes) == 1)
+	nodesSearched += (long)nodes;
+    }
+    fclose(fp);
+  }
+}
+/*+F
+ ********************************************************
+ *
+ * writeHistogram - write histograms of one name to the metrics
+ *
+ * Parameters:
+ *
+ * FILE *fp - the metrics file
+ * char *name - the metric name
+ * char *help - what it is
+ * HISTOGRAM *histograms - the histograms, each with the label that
+ *                         sets it apart, if more than one
+ * int numHistograms - how many there are
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeHistogram(FILE *fp, char *name, char *help,
+			   HISTOGRAM *histograms, int numHistograms)
+{
+  static double bounds[NUM_BUCKETS] = BUCKET_BOUNDS;
+  char label[80];
+  int index, bucket;
+
+  fprintf(fp,"# HELP %s %s\n",name,help);
+  fprintf(fp,"# TYPE %s histogram\n",name);
+  for (index=0;index<numHistograms;index++) {
+    label[0] = '\0';
+    if (numHistograms > 1 || histograms[index].label[0] != '\0')
+      sprintf(label,"stage=\"%s\",",histograms[index].label);
+    for (bucket=0;bucket<NUM_BUCKETS;bucket++)
+      fprintf(fp,"%s_bucket{%sle=\"%g\"} %ld\n",name,label,bounds[bucket],
+	      histograms[index].counts[bucket]);
+    fprintf(fp,"%s_bucket{%sle=\"+Inf\"} %ld\n",name,label,
+	    histograms[index].count);
+    if (label[0] != '\0') {
+      label[strlen(label)-1] = '\0';
+      fprintf(fp,"%s_sum{%s} %.3f\n",name,label,histograms[index].sum);
+      fprintf(fp,"%s_count{%s} %ld\n",name,label,histograms[index].count);
+    } else {
+      fprintf(fp,"%s_sum %.3f\n",name,histograms[index].sum);
+      fprintf(fp,"%s_count %ld\n",name,histograms[index].count);
+    }
+  }
+}
+/*+F
+ ********************************************************
+ *
+ * writeMetrics - write the metrics file, if there is one
+ *
+ * It is written under a hidden name and renamed into place, so that
+ * it is never read half written. The metrics lock must be held.
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeMetrics(void)
+{
+  char tempName[PATH_MAX+8];
+  FILE *fp;
+
+  if (metricsFileName == NULL ||
+      !formatPath(tempName,sizeof(tempName),"%s.tmp",metricsFileName) ||
+      (fp = fopen(tempName,"w")) == NULL) return;
+
+  writeHistogram(fp,"ingest_queue_wait_seconds",
+		 "Time a file waited for a worker",&queueWait,1);
+  writeHistogram(fp,"ingest_check_seconds",
+		 "Time to check or convert a file",&checkTime,1);
+  writeHistogram(fp,"ingest_analysis_seconds",
+		 "Time to analyze a mass spec",&analysisTime,1);
+  writeHistogram(fp,"ingest_stage_seconds",
+		 "Time in each stage of the analysis",stageTimes,numStages);
+  writeHistogram(fp,"ingest_job_cpu_seconds",
+		 "CPU time of an analysis",&jobCpu,1);
+
+  fprintf(fp,"# HELP ingest_jobs_running Analyses running\n");
+  fprintf(fp,"# TYPE ingest_jobs_running gauge\n");
+  fprintf(fp,"ingest_jobs_running %d\n",jobsRunning);
+  fprintf(fp,"# HELP ingest_queue_depth Files waiting for a worker\n");
+  fprintf(fp,"# TYPE ingest_queue_depth gauge\n");
+  fprintf(fp,"ingest_queue_depth %d\n",queueDepth);
+  fprintf(fp,"# HELP ingest_job_max_rss_bytes Most memory an analysis used\n");
+  fprintf(fp,"# TYPE ingest_job_max_rss_bytes gauge\n");
+  fprintf(fp,"ingest_job_max_rss_bytes %ld\n",maxRss);
+  fprintf(fp,"# HELP ingest_jobs_total Files handled, by how they ended\n");
+  fprintf(fp,"# TYPE ingest_jobs_total counter\n");
+  fprintf(fp,"ingest_jobs_total{result=\"done\"} %ld\n",jobsDone);
+  fprintf(fp,"ingest_jobs_total{result=\"failed\"} %ld\n",jobsFailed);
+  fprintf(fp,"ingest_jobs_total{result=\"ignored\"} %ld\n",jobsIgnored);
+  fprintf(fp,"ingest_jobs_total{result=\"rejected\"} %ld\n",jobsRejected);
+  fprintf(fp,"# HELP ingest_search_nodes_total Combinations searched\n");
+  fprintf(fp,"# TYPE ingest_search_nodes_total counter\n");
+  fprintf(fp,"ingest_search_nodes_total %ld\n",nodesSearched);
+
+  fclose(fp);
+  rename(tempName,metricsFileName);
+}
+/*+F
+ ********************************************************
+ *
+ * catchSignal - stop watching, letting the analyses running finish
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void catchSignal(int signalNumber)
+{
+  (void)signalNumber;
+  stopWatching = 1;
+}
+/*+F
+ ********************************************************
+ *
+ * queueJob - add a file to the queue, waiting for room if need be
+ *
+ * Parameters:
+ *
+ * char *name - the name of the file in the data directory
+ *
+ * Returns: 1 if queued, 0 if we are shutting down instead
+ ********************************************************
+ */
+static int queueJob(char *name)
+{
+  int depth;
+
+  pthread_mutex_lock(&queueMutex);
+  while (queueSize == MAX_QUEUE && !shuttingDown)
+    pthread_cond_wait(&queueNotFull,&queueMutex);
+  if (shuttingDown) {
+    pthread_mutex_unlock(&queueMutex);
+    return(0);
+  }
+  strncpy(jobQueue[(queueHead + queueSize) % MAX_QUEUE].name,name,NAME_MAX);
+  jobQueue[(queueHead + queueSize) % MAX_QUEUE].name[NAME_MAX] = '\0';
+  jobQueue[(queueHead + queueSize) % MAX_QUEUE].queued = secondsNow();
+  depth = ++queueSize;
+  pthread_cond_signal(&queueNotEmpty);
+  pthread_mutex_unlock(&queueMutex);
+
+  pthread_mutex_lock(&metricsMutex);
+  queueDepth = depth;
+  writeMetrics();
+  pthread_mutex_unlock(&metricsMutex);
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * nextJob - take the next file off the queue, waiting for one
+ *
+ * Parameters:
+ *
+ * INGEST_JOB *job - the job, returned
+ *
+ * Returns: 1 if there is a job, 0 if the queue is shut down and empty
+ ********************************************************
+ */
+static int nextJob(INGEST_JOB *job)
+{
+  pthread_mutex_lock(&queueMutex);
+  while (queueSize == 0 && !shuttingDown)
+    pthread_cond_wait(&queueNotEmpty,&queueMutex);
+  if (queueSize == 0) {
+    pthread_mutex_unlock(&queueMutex);
+    return(0);
+  }
+  *job = jobQueue[queueHead];
+  queueHead = (queueHead + 1) % MAX_QUEUE;
+  queueSize--;
+  pthread_mutex_lock(&metricsMutex);
+  queueDepth = queueSize;
+  observeTime(&queueWait,secondsNow() - job->queued);
+  pthread_mutex_unlock(&metricsMutex);
+  pthread_cond_signal(&queueNotFull);
+  pthread_mutex_unlock(&queueMutex);
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * runWorker - work through the queue until it is shut down
+ *
+ * A file already named ID-data.csv is analyzed, if its ID is valid;
+ * any other is converted, and its converted form comes back through
+ * the queue.
+ *
+ * Returns: NULL
+ ********************************************************
+ */
+static void *runWorker(void *vUnused)
+{
+  char id[NAME_MAX+1];
+  char fileName[PATH_MAX+NAME_MAX+2];
+  size_t length, suffixLength = strlen(DATA_SUFFIX);
+  int isSpectrum;
+  double startTime;
+  INGEST_JOB job;
+
+  (void)vUnused;
+  while (nextJob(&job)) {
+    startTime = secondsNow();
+    length = strlen(job.name);
+    if (length <= suffixLength ||
+	strcmp(job.name + length - suffixLength,DATA_SUFFIX)) {
+      convertSpectrum(job.name);
+      pthread_mutex_lock(&metricsMutex);
+      observeTime(&checkTime,secondsNow() - startTime);
+      writeMetrics();
+      pthread_mutex_unlock(&metricsMutex);
+      continue;
+    }
+    strcpy(id,job.name);
+    id[length - suffixLength] = '\0';
+    if (!validId(id)) {
+      pthread_mutex_lock(&metricsMutex);
+      jobsRejected++;
+      writeMetrics();
+      pthread_mutex_unlock(&metricsMutex);
+      logMessage("%s: not a valid ID, rejected",job.name);
+      continue;
+    }
+
+    /* Check it first, so that files that aren't ours are left alone */
+    isSpectrum =
+      formatPath(fileName,sizeof(fileName),"%s/%s",dataDir,job.name) &&
+      checkSpectrum(fileName,NULL);
+    pthread_mutex_lock(&metricsMutex);
+    observeTime(&checkTime,secondsNow() - startTime);
+    if (!isSpectrum) {
+      jobsIgnored++;
+      writeMetrics();
+    }
+    pthread_mutex_unlock(&metricsMutex);
+    if (!isSpectrum) {
+      logMessage("%s: not a mass spec, ignored",job.name);
+      continue;
+    }
+    analyzeSpectrum(id);
+  }
+
+  return(NULL);
+}
+/*+F
+ ********************************************************
+ *
+ * validId - check that an ID is safe to pass to the analysis
+ *
+ * The ID names files and is an argument of the commands the analysis
+ * runs, so it may only have letters, digits, '_' and '-'.
+ *
+ * Parameters:
+ *
+ * char *id - the ID
+ *
+ * Returns: 1 if the ID is valid, 0 if not
+ ********************************************************
+ */
+static int validId(char *id)
+{
+  char *c;
+
+  if (*id == '\0') return(0);
+  for (c=id;*c;c++)
+    if (!(*c >= 'A' && *c <= 'Z') && !(*c >= 'a' && *c <= 'z') &&
+	!(*c >= '0' && *c <= '9') && *c != '_' && *c != '-') return(0);
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * readPoint - read a mass and intensity from a line
+ *
+ * The two may be separated by a comma, semicolon, tab or spaces, and
+ * the line must have nothing else on it.
+ *
+ * Parameters:
+ *
+ * char *line - the line
+ * double *mass, *intensity - the point, returned
+ *
+ * Returns: 1 if the line is a point, 0 if not
+ ********************************************************
+ */
+static int readPoint(char *line, double *mass, double *intensity)
+{
+  char *end;
+
+  *mass = strtod(line,&end);
+  if (end == line) return(0);
+  line = end;
+  while (*line == ' ' || *line == '\t') line++;
+  if (*line == ',' || *line == ';') line++;
+  *intensity = strtod(line,&end);
+  if (end == line) return(0);
+  for (line=end;*line!='\0';line++)
+    if (*line != ' ' && *line != '\t' && *line != '\r' && *line != '\n')
+      return(0);
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * checkSpectrum - check that a file is a mass spec, and convert it
+ *
+ * A mass spec is a few header lines followed by at least MIN_POINTS
+ * lines of mass and intensity, with the masses mostly increasing
+ * (some exports put processed data after the spectrum, which the
+ * analysis trims off).
+ *
+ * Parameters:
+ *
+ * char *fileName - the file
+ * FILE *convertFp - where to write it in the form the analysis reads,
+ *                   or NULL to just check it
+ *
+ * Returns: 1 if it is a mass spec, 0 if not
+ ********************************************************
+ */
+static int checkSpectrum(char *fileName, FILE *convertFp)
+{
+  char line[256];
+  int numLines = 0, numPoints = 0, numIncreasing = 0;
+  double mass, intensity, lastMass = 0.0;
+  FILE *fp;
+
+  if ((fp = fopen(fileName,"r")) == NULL) return(0);
+
+  while (fgets(line,sizeof(line),fp) != NULL) {
+    numLines++;
+    if (!readPoint(line,&mass,&intensity)) {
+
+      /* Only the header may be anything else */
+      if (numPoints > 0 || numLines > HEADER_LINES) break;
+      continue;
+    }
+    if (numPoints > 0 && mass > lastMass) numIncreasing++;
+    lastMass = mass;
+    numPoints++;
+    if (convertFp != NULL) fprintf(convertFp,"%.6f,%.6f\n",mass,intensity);
+  }
+  fclose(fp);
+
+  return(numPoints >= MIN_POINTS && 2 * numIncreasing > numPoints);
+}
+/*+F
+ ********************************************************
+ *
+ * convertSpectrum - convert a dropped file into ID-data.csv
+ *
+ * The converted file is written under a hidden name and renamed into
+ * place, so that it lands complete.
+ *
+ * Parameters:
+ *
+ * char *name - the name of the file in the data directory
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void convertSpectrum(char *name)
+{
+  char id[64];
+  char fileName[PATH_MAX+NAME_MAX+2];
+  char tempName[PATH_MAX+NAME_MAX+2];
+  char dataName[PATH_MAX+NAME_MAX+2];
+  int index;
+  FILE *fp;
+
+  /* Only .csv files, and not our own hidden ones */
+  if (name[0] == '.' || strlen(name) < 4 ||
+      strcmp(name + strlen(name) - 4,".csv")) return;
+
+  pthread_mutex_lock(&idMutex);
+  sprintf(id,"%ld%03d",(long)time(NULL),numConverted++ % 1000);
+  pthread_mutex_unlock(&idMutex);
+
+  if (!formatPath(fileName,sizeof(fileName),"%s/%s",dataDir,name) ||
+      !formatPath(tempName,sizeof(tempName),"%s/.%s%s",dataDir,id,DATA_SUFFIX) ||
+      !formatPath(dataName,sizeof(dataName),"%s/%s%s",dataDir,id,DATA_SUFFIX))
+    return;
+  if ((fp = fopen(tempName,"w")) == NULL) {
+    logMessage("%s: unable to write %s",name,tempName);
+    return;
+  }
+  fprintf(fp,"# Converted by ingestMassSpec from %s\n",name);
+  for (index=1;index<HEADER_LINES-1;index++) fprintf(fp,"#\n");
+  fprintf(fp,"M/Z,Intensity\n");
+  if (!checkSpectrum(fileName,fp)) {
+    fclose(fp);
+    unlink(tempName);
+    pthread_mutex_lock(&metricsMutex);
+    jobsIgnored++;
+    pthread_mutex_unlock(&metricsMutex);
+    logMessage("%s: not a mass spec, ignored",name);
+    return;
+  }
+  fclose(fp);
+
+  if (rename(tempName,dataName) != 0) {
+    logMessage("%s: unable to rename to %s",name,dataName);
+    unlink(tempName);
+    return;
+  }
+  logMessage("%s: converted to ID %s",name,id);
+}
+/*+F
+ ********************************************************
+ *
+ * writeStatus - set the status line of an analysis, atomically
+ *
+ * Parameters:
+ *
+ * char *id - the ID
+ * char *status - the line
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeStatus(char *id, char *status)
+{
+  char fileName[PATH_MAX+NAME_MAX+2];
+  char tempName[PATH_MAX+NAME_MAX+2];
+  FILE *fp;
+
+  if (!formatPath(fileName,sizeof(fileName),"%s/Status-%s.txt",
+		  outputDir,id) ||
+      !formatPath(tempName,sizeof(tempName),"%s/.Status-%s.txt",
+		  outputDir,id) ||
+      (fp = fopen(tempName,"w")) == NULL) return;
+  fprintf(fp,"%s\n",status);
+  fclose(fp);
+  rename(tempName,fileName);
+}
+/*+F
+ ********************************************************
+ *
+ * analyzeSpectrum - run the analysis of a spectrum and publish it
+ *
+ * The analysis runs in a directory of its own in the output directory
+ * (so that the renames out of it stay on one file system), with its
+ * output logged to Log-ID.txt there.
+ *
+ * Parameters:
+ *
+ * char *id - the ID of the spectrum, in dataDir/ID-data.csv
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void analyzeSpectrum(char *id)
+{
+  char workDir[PATH_MAX+NAME_MAX+2];
+  char logName[PATH_MAX+NAME_MAX+2];
+  char status[NAME_MAX+64];
+  int logFd, childStatus;
+  FILE *fp;
+  double startTime;
+  pid_t childId;
+  sigset_t signals;
+  struct rusage usage;
+
+  if (!formatPath(workDir,sizeof(workDir),"%s/.ingest-%s-XXXXXX",
+		  outputDir,id))
+    return;
+  if (mkdtemp(workDir) == NULL) {
+    logMessage("%s: unable to make a work directory: %s",id,strerror(errno));
+    return;
+  }
+  writeStatus(id,"Analysis running");
+  logMessage("%s: analysis started",id);
+  startTime = secondsNow();
+  pthread_mutex_lock(&metricsMutex);
+  jobsRunning++;
+  writeMetrics();
+  pthread_mutex_unlock(&metricsMutex);
+
+  /* The log is opened before the fork, as the child of a threaded
+   * process may only make async-signal-safe calls (no stdio) until it
+   * execs; it is close on exec so that the other workers' children
+   * don't hold it open */
+  logFd = -1;
+  if (formatPath(logName,sizeof(logName),"%s/Log-%s.txt",workDir,id))
+    logFd = open(logName,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+  sigemptyset(&signals);
+  if (logFd < 0) childId = -1;
+  else if ((childId = fork()) == 0) {
+    sigprocmask(SIG_SETMASK,&signals,NULL);
+    if (chdir(workDir) != 0 || dup2(logFd,1) < 0 || dup2(logFd,2) < 0)
+      _exit(127);
+    execlp("Rscript","Rscript",scriptName,id,".",dataDir,outputDir,
+	   (char *)NULL);
+    _exit(127);
+  }
+  if (logFd >= 0) close(logFd);
+  memset(&usage,0,sizeof(usage));
+  if (childId < 0 || wait4(childId,&childStatus,0,&usage) != childId) {
+    logMessage("%s: unable to run the analysis: %s",id,strerror(errno));
+    childStatus = -1;
+  }
+
+  /* The usage is of the child and everything it waited for */
+  pthread_mutex_lock(&metricsMutex);
+  jobsRunning--;
+  observeTime(&analysisTime,secondsNow() - startTime);
+  observeTime(&jobCpu,usage.ru_utime.tv_sec + 1e-6*usage.ru_utime.tv_usec +
+	      usage.ru_stime.tv_sec + 1e-6*usage.ru_stime.tv_usec);
+  if (1024L * usage.ru_maxrss > maxRss) maxRss = 1024L * usage.ru_maxrss;
+  observeStages(workDir,id);
+  if (WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0)
+    jobsDone++;
+  else
+    jobsFailed++;
+  writeMetrics();
+  pthread_mutex_unlock(&metricsMutex);
+
+  /* 
+   * A search keeps its progress in the status, and leaves its final
+   * line there; if there wasn't one, say so
+   */
+  if (WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0) {
+    status[0] = '\0';
+    if (formatPath(logName,sizeof(logName),"%s/Status-%s.txt",
+		   outputDir,id) &&
+	(fp = fopen(logName,"r")) != NULL) {
+      if (fgets(status,sizeof(status),fp) == NULL) status[0] = '\0';
+      fclose(fp);
+    }
+    if (status[0] == '\0' || !strcmp(status,"Analysis running\n"))
+      writeStatus(id,"Analysis done");
+  }
+
+  publishResults(workDir,id);
+  if (WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0) {
+    logMessage("%s: analysis done",id);
+  } else {
+    snprintf(status,sizeof(status),
+	     "Analysis failed (status %d): see Log-%s.txt",childStatus,id);
+    writeStatus(id,status);
+    logMessage("%s: %s",id,status);
+  }
+}
+/*+F
+ ********************************************************
+ *
+ * publishResults - move the results of an analysis into place
+ *
+ * Each file is renamed into the output directory, which is atomic,
+ * and the plot, which is what the page waits for, goes last.
+ *
+ * Parameters:
+ *
+ * char *workDir - the directory the analysis ran in
+ * char *id - the ID
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void publishResults(char *workDir, char *id)
+{
+  char fileName[PATH_MAX+NAME_MAX+2];
+  char finalName[PATH_MAX+NAME_MAX+2];
+  char plotName[NAME_MAX+16];
+  struct dirent *entry;
+  DIR *dir;
+
+  snprintf(plotName,sizeof(plotName),"MassSpec-%s.png",id);
+  if ((dir = opendir(workDir)) != NULL) {
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.' || !strcmp(entry->d_name,plotName))
+	continue;
+      if (formatPath(fileName,sizeof(fileName),"%s/%s",
+		     workDir,entry->d_name) &&
+	  formatPath(finalName,sizeof(finalName),"%s/%s",
+		     outputDir,entry->d_name))
+	rename(fileName,finalName);
+    }
+    closedir(dir);
+  }
+  if (formatPath(fileName,sizeof(fileName),"%s/%s",workDir,plotName) &&
+      formatPath(finalName,sizeof(finalName),"%s/%s",outputDir,plotName))
+    rename(fileName,finalName);
+
+  /* Anything left is hidden, and stays with the directory */
+  if (rmdir(workDir) != 0)
+    logMessage("%s: left %s behind",id,workDir);
+}
+/* The main routine. See the header for the usage */
+int main(int argc, char **argv)
+{
+  char *pName;
+  char *dataName = "./mic-data";
+  char *outputName = "./mic-output";
+  char *scriptPath = "./analyzeMassSpec.R";
+  char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+  char *next;
+  ssize_t length;
+  int index, watchFd;
+  pthread_t *workerIds;
+  struct inotify_event *event;
+  struct sigaction action;
+  sigset_t signals;
+
+  /* Parse the options */
+  pName = argv[0]; argc--; argv++;
+  while (argc > 0) {
+    if (argc < 2) USAGE(pName);
+    if (!strcmp(argv[0],"-data")) {
+      dataName = argv[1];
+    } else if (!strcmp(argv[0],"-output")) {
+      outputName = argv[1];
+    } else if (!strcmp(argv[0],"-script")) {
+      scriptPath = argv[1];
+    } else if (!strcmp(argv[0],"-workers")) {
+      if (sscanf(argv[1],"%d",&numWorkers) != 1 || numWorkers < 1)
+	USAGE(pName);
+    } else if (!strcmp(argv[0],"-metrics")) {
+      metricsFileName = argv[1];
+    } else {
+      USAGE(pName);
+    }
+    argc -= 2; argv += 2;
+  }
+
+  /* The analyses run elsewhere, so we need the full paths */
+  if (realpath(dataName,dataDir) == NULL ||
+      realpath(outputName,outputDir) == NULL ||
+      realpath(scriptPath,scriptName) == NULL) {
+    printf("Unable to find %s, %s or %s\n",dataName,outputName,scriptPath);
+    exit(1);
+  }
+
+  /* Start watching before the workers, so that nothing is missed */
+  if ((watchFd = inotify_init()) < 0 ||
+      inotify_add_watch(watchFd,dataDir,IN_CLOSE_WRITE|IN_MOVED_TO) < 0) {
+    printf("Unable to watch %s: %s\n",dataDir,strerror(errno));
+    exit(1);
+  }
+
+  memset(&action,0,sizeof(action));
+  action.sa_handler = catchSignal;
+  sigaction(SIGINT,&action,NULL);
+  sigaction(SIGTERM,&action,NULL);
+
+  if ((workerIds = malloc(numWorkers * sizeof(pthread_t))) == NULL) {
+    printf("Unable to allocate %d workers\n",numWorkers);
+    exit(1);
+  }
+
+  /* The workers leave the signals to us, so that they stop the read */
+  sigemptyset(&signals);
+  sigaddset(&signals,SIGINT);
+  sigaddset(&signals,SIGTERM);
+  pthread_sigmask(SIG_BLOCK,&signals,NULL);
+  for (index=0;index<numWorkers;index++)
+    pthread_create(&workerIds[index],NULL,runWorker,NULL);
+  pthread_sigmask(SIG_UNBLOCK,&signals,NULL);
+  logMessage("Watching %s with %d workers",dataDir,numWorkers);
+  pthread_mutex_lock(&metricsMutex);
+  writeMetrics();
+  pthread_mutex_unlock(&metricsMutex);
+
+  /* Queue every file that lands until we are told to stop */
+  while (!stopWatching) {
+    if ((length = read(watchFd,buffer,sizeof(buffer))) <= 0) {
+      if (length < 0 && errno == EINTR) continue;
+      printf("Unable to read events: %s\n",strerror(errno));
+      break;
+    }
+    for (next=buffer;next<buffer+length;
+	 next+=sizeof(struct inotify_event)+event->len) {
+      event = (struct inotify_event *)next;
+      if (event->mask & IN_Q_OVERFLOW)
+	logMessage("Too many files at once: some were missed");
+      if (event->len == 0 || event->name[0] == '.' ||
+	  (event->mask & IN_ISDIR)) continue;
+      logMessage("%s: landed",event->name);
+      if (!queueJob(event->name)) break;
+    }
+  }
+
+  /* Let the workers finish what is queued, and wait for them */
+  logMessage("Stopping: finishing the queued analyses");
+  pthread_mutex_lock(&queueMutex);
+  shuttingDown = 1;
+  pthread_cond_broadcast(&queueNotEmpty);
+  pthread_cond_broadcast(&queueNotFull);
+  pthread_mutex_unlock(&queueMutex);
+  for (index=0;index<numWorkers;index++)
+    pthread_join(workerIds[index],NULL);
+
+  close(watchFd);
+  exit(0);
+}
@@ -0,0 +1,320 @@
+/*+C
+ ******************************************************************
+ * This program merges the outputs of a composition search that was
+ * sharded across processes or machines by running
+ * computeParallelPeptideComposition with the -shard option.
+ *
+ * Usage: mergePeptideCompositions ID numShards
+ *
+ * where:
+ *
+ * ID is the unique run ID given to all of the shards
+ * numShards is the number of shards the search was split into
+ *
+ * For each mass searched (numbered from 0 as in the shard outputs) it
+ * reads Compositions-ID-N-shard-i-of-numShards.csv from every shard
+ * and writes them all as Compositions-ID-N.csv, the file an unsharded
+ * run would have written, sorted so that the result does not depend
+ * on which shard finished first. It reads the matching Statistics
+ * files and writes Statistics-ID-N.csv, which sums them.
+ *
+ * A search by classes (-merge_isobaric) writes
+ * ClassCompositions-ID-N-shard-i-of-numShards.csv instead, or as
+ * well with -expand. These are merged the same way into
+ * ClassCompositions-ID-N.csv, under the header naming the classes,
+ * which must be the same in every shard.
+ *
+ * Shards that are missing are reported and the merged statistics say
+ * how many were found, as does the share of the search covered.
+ ******************************************************************
+ */
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* File-Scope Constants, Macros, and Enumerations */
+
+/* This is the longest line we expect in a composition file */
+#define MAX_LINE_SIZE (256)
+
+/* This is the usage error */
+#define USAGE(pname) \
+  {printf("Usage: %s ID numShards\n",pname); exit(1);}
+
+/* File-Scope Type Definitions */
+
+/* The statistics for a mass, as written by the shards and merged */
+typedef struct {
+  double mass;
+  int numFound;
+  long shardCost;
+  long totalCost;
+  long numMatches;
+  long numCombinations;
+  double covered;
+  double runTime;
+  double maxRunTime;
+} SHARD_STATISTICS;
+
+/* File-Scope Variables */
+
+/* The lines of compositions read so far, and how many there is room for */
+static char **lines = NULL;
+static int numLines = 0;
+static int maxLines = 0;
+
+/* File-Scope Prototypes */
+static int readCompositions(char *fileName, char *header);
+static int mergeCompositions(char *kind, char *idName, int itry,
+			     int numShards, int hasHeader, int *numMerged);
+static int readStatistics(char *fileName, SHARD_STATISTICS *statistics);
+static int compareLines(const void *first, const void *second);
+
+/*+F
+ ********************************************************
+ *
+ * readCompositions - add the compositions in a file to the lines
+ *
+ * Parameters:
+ *
+ * char *fileName - the name of the shard composition file
+ * char *header - if not NULL, the first line of the file is a header
+ *                and is returned here (MAX_LINE_SIZE) rather than
+ *                added to the lines
+ *
+ * Returns: 1 if the file was read, 0 if it could not be opened
+ ********************************************************
+ */
+static int readCompositions(char *fileName, char *header)
+{
+  char line[MAX_LINE_SIZE];
+  FILE *fp;
+
+  if ((fp = fopen(fileName,"r")) == NULL) return(0);
+  if (header != NULL && fgets(header,MAX_LINE_SIZE,fp) == NULL)
+    header[0] = '\0';
+
+  while (fgets(line,sizeof(line),fp) != NULL) {
+    if (line[0] == '\n') continue;
+
+    if (numLines == maxLines) {
+      maxLines = maxLines > 0 ? 2 * maxLines : 1024;
+      if ((lines = realloc(lines,maxLines * sizeof(char *))) == NULL) {
+	printf("Unable to allocate %d lines\n",maxLines);
+	exit(1);
+      }
+    }
+    if ((lines[numLines++] = strdup(line)) == NULL) {
+      printf("Unable to allocate line %d\n",numLines);
+      exit(1);
+    }
+  }
+
+  fclose(fp);
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * mergeCompositions - merge the shard files of one kind for a mass
+ *
+ * The compositions of every shard found are sorted together and
+ * written to kind-ID-N.csv, after the header if the files have one.
+ * Nothing is written if no shard has a file of this kind.
+ *
+ * Parameters:
+ *
+ * char *kind - the start of the file names, such as "Compositions"
+ * char *idName - the run ID
+ * int itry - the mass, from 0
+ * int numShards - the number of shards
+ * int hasHeader - whether the files start with a header
+ * int *numMerged - the number of compositions written, returned
+ *
+ * Returns: the number of shards found
+ ********************************************************
+ */
+static int mergeCompositions(char *kind, char *idName, int itry,
+			     int numShards, int hasHeader, int *numMerged)
+{
+  char fileName[128];
+  char header[MAX_LINE_SIZE], shardHeader[MAX_LINE_SIZE];
+  int shard, index, numFound = 0;
+  FILE *fp;
+
+  numLines = 0;
+  header[0] = '\0';
+  for (shard=1;shard<=numShards;shard++) {
+    sprintf(fileName,"%s-%s-%d-shard-%d-of-%d.csv",
+	    kind,idName,itry,shard,numShards);
+    if (!readCompositions(fileName,hasHeader ? shardHeader : NULL))
+      continue;
+
+    /* The shards must agree on the classes */
+    if (hasHeader && numFound > 0 && strcmp(header,shardHeader)) {
+      printf("Mass %d: the header of <%s> is not that of the other "
+	     "shards\n",itry,fileName);
+      exit(1);
+    }
+    if (hasHeader && numFound == 0) strcpy(header,shardHeader);
+    numFound++;
+  }
+  *numMerged = numLines;
+  if (numFound == 0) return(0);
+  if (numFound < numShards)
+    printf("Mass %d: only %d of %d %s shards found\n",
+	   itry,numFound,numShards,kind);
+
+  /* Sort and write the compositions */
+  qsort(lines,numLines,sizeof(char *),compareLines);
+  sprintf(fileName,"%s-%s-%d.csv",kind,idName,itry);
+  if ((fp = fopen(fileName,"w")) == NULL) {
+    printf("Unable to open file <%s>\n",fileName);
+    exit(1);
+  }
+  fputs(header,fp);
+  for (index=0;index<numLines;index++) {
+    if (index > 0 && !strcmp(lines[index],lines[index-1]))
+      printf("Mass %d: duplicate composition %s",itry,lines[index]);
+    fputs(lines[index],fp);
+    free(lines[index]);
+  }
+  fclose(fp);
+
+  return(numFound);
+}
+/*+F
+ ********************************************************
+ *
+ * readStatistics - add the statistics in a file to those so far
+ *
+ * The costs and coverage are added so that the coverage of the whole
+ * is the cost-weighted sum of the coverage of the shards.
+ *
+ * Parameters:
+ *
+ * char *fileName - the name of the shard statistics file
+ * SHARD_STATISTICS *statistics - the statistics to add them to
+ *
+ * Returns: 1 if the file was read, 0 if not
+ ********************************************************
+ */
+static int readStatistics(char *fileName, SHARD_STATISTICS *statistics)
+{
+  char line[MAX_LINE_SIZE];
+  int shard, numShards;
+  SHARD_STATISTICS shardStatistics;
+  FILE *fp;
+
+  if ((fp = fopen(fileName,"r")) == NULL) return(0);
+
+  /* Skip the header and read the one line of numbers */
+  if (fgets(line,sizeof(line),fp) == NULL ||
+      fgets(line,sizeof(line),fp) == NULL ||
+      sscanf(line,"%lf,%d,%d,%ld,%ld,%ld,%ld,%lf,%lf",
+	     &shardStatistics.mass,&shard,&numShards,
+	     &shardStatistics.shardCost,&shardStatistics.totalCost,
+	     &shardStatistics.numMatches,&shardStatistics.numCombinations,
+	     &shardStatistics.covered,&shardStatistics.runTime) != 9) {
+    printf("Unable to read statistics from <%s>\n",fileName);
+    fclose(fp);
+    return(0);
+  }
+  fclose(fp);
+
+  statistics->mass = shardStatistics.mass;
+  statistics->numFound++;
+  statistics->totalCost = shardStatistics.totalCost;
+  statistics->numMatches += shardStatistics.numMatches;
+  statistics->numCombinations += shardStatistics.numCombinations;
+  if (shardStatistics.totalCost > 0)
+    statistics->covered += shardStatistics.covered *
+      shardStatistics.shardCost / shardStatistics.totalCost;
+  statistics->runTime += shardStatistics.runTime;
+  if (shardStatistics.runTime > statistics->maxRunTime)
+    statistics->maxRunTime = shardStatistics.runTime;
+
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * compareLines - order two composition lines for qsort
+ *
+ * The counts are zero padded and the mass has fixed decimals, so
+ * the plain string order is the order of the counts.
+ *
+ * Returns: as strcmp
+ ********************************************************
+ */
+static int compareLines(const void *first, const void *second)
+{
+  return(strcmp(*(char * const *)first,*(char * const *)second));
+}
+/* The main routine. See the header for the usage */
+int main(int argc, char **argv)
+{
+  char *pName, *idName;
+  char fileName[128];
+
+  int itry, shard, numShards, numFound, numClassFound;
+  int numMerged, numClassMerged;
+
+  SHARD_STATISTICS statistics;
+
+  FILE *fp;
+
+  /* Parse the input arguments */
+  pName = argv[0]; argc--; argv++;
+  if (argc != 2 || sscanf(argv[1],"%d",&numShards) != 1 || numShards < 1)
+    USAGE(pName);
+  idName = argv[0];
+
+  /* Go through the masses until no shard has one */
+  for (itry=0;;itry++) {
+
+    /* The compositions, and the class compositions, of every shard */
+    numFound = mergeCompositions("Compositions",idName,itry,numShards,0,
+				 &numMerged);
+    numClassFound = mergeCompositions("ClassCompositions",idName,itry,
+				      numShards,1,&numClassMerged);
+    if (numFound == 0 && numClassFound == 0) break;
+
+    memset(&statistics,0,sizeof(statistics));
+    for (shard=1;shard<=numShards;shard++) {
+      sprintf(fileName,"Statistics-%s-%d-shard-%d-of-%d.csv",
+	      idName,itry,shard,numShards);
+      if (!readStatistics(fileName,&statistics))
+	printf("Missing statistics for shard %d of mass %d\n",shard,itry);
+    }
+
+    /* And the statistics */
+    sprintf(fileName,"Statistics-%s-%d.csv",idName,itry);
+    if ((fp = fopen(fileName,"w")) == NULL) {
+      printf("Unable to open file <%s>\n",fileName);
+      exit(1);
+    }
+    fprintf(fp,"Mass,NumShards,ShardsFound,Matches,Combinations,"
+	    "Covered,RunTime,MaxRunTime\n");
+    fprintf(fp,"%.4f,%d,%d,%ld,%ld,%.6f,%.3f,%.3f\n",
+	    statistics.mass,numShards,statistics.numFound,
+	    statistics.numMatches,statistics.numCombinations,
+	    statistics.covered,statistics.runTime,statistics.maxRunTime);
+    fclose(fp);
+
+    if (numFound > 0)
+      printf(" Mass %.4f: %d compositions from %d shards\n",
+	     statistics.mass,numMerged,numFound);
+    if (numClassFound > 0)
+      printf(" Mass %.4f: %d class compositions from %d shards\n",
+	     statistics.mass,numClassMerged,numClassFound);
+  }
+
+  if (itry == 0) {
+    printf("No shards found for ID <%s>\n",idName);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,632 @@
+/*+C
+ ******************************************************************
+ * This is the plate reduction of mic.R in C, to be loaded into R and
+ * called with .C. It reads the plate reader upload once and, for each
+ * pair of plates (one time point read twice), gives the means that
+ * mic.R plots, with the blank subtracted. To build it, make or
+ *
+ *   R CMD SHLIB reducePlates.c
+ *
+ * which makes reducePlates.so; mic.R reduces the plates in R if it has
+ * not been built. From R:
+ *
+ *   dyn.load("reducePlates.so")
+ *   numPlates <- .C("countPlates", fileName, numPlates=integer(1))$numPlates
+ *   reduced <- .C("reducePlates", fileName, as.integer(numPairs),
+ *                 blanks=double(numPairs), peptide1=double(10*numPairs),
+ *                 peptide2=double(10*numPairs), control=double(10*numPairs),
+ *                 lastRow=double(10*numPairs), bacteria=double(numPairs))
+ *
+ * The upload is a CSV of 9 row plates, a header row and 8 of wells,
+ * with the two plates of a pair one after the other. In each plate
+ *
+ *   rows 2-7, column 1   are the blanks
+ *   rows 2-4, columns 2-11 are peptide 1, at 10 concentrations
+ *   rows 5-7, columns 2-11 are peptide 2
+ *   row 8, columns 2-11  is the control antibiotic
+ *   row 9, column 2      is the last row (the same for every column)
+ *   rows 2-7, column 12  is the bacteria alone
+ *
+ * Each is the mean over both plates of the pair, and all but the
+ * blanks have the blank of the pair taken off. The matrices are
+ * numPairs by 10, in R (column major) order. Anything that is not a
+ * number is NaN, which R takes as NA, and which makes the means it is
+ * in NA, as mean() would.
+ *
+ * micStreamUpdate is for a run still being read. Each call reads only
+ * the plates added to the upload since the last, keeping what it needs
+ * (the first pair, the last, the pair at the cutoff and any plate read
+ * half way) in a small state file, and gives the growth at each
+ * concentration and the MIC and MLC as they stand. micStream.R calls
+ * it.
+ *
+ * Nothing R is needed to compile it, so it can be tried standalone.
+ ******************************************************************
+ */
+
+/* Includes */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* File-Scope Constants, Macros, and Enumerations */
+
+/* This is the number of rows and columns read from each plate */
+#define PLATE_ROWS (9)
+#define PLATE_COLUMNS (12)
+
+/* This is the number of concentrations */
+#define NUM_CONCENTRATIONS (10)
+
+/* This is the line buffer first made for an upload, grown as needed */
+#define LINE_SIZE (1024)
+
+/* This is the first line of a state file, which says what it holds */
+#define STATE_VERSION "micStream 2"
+
+/* This is the most of the start of an upload that identifies it */
+#define IDENTITY_BYTES (4096)
+
+/* This is the number of results (MIC and MLC of each row group) */
+#define NUM_GROUPS (3)
+
+/* File-Scope Type Definitions */
+
+/* The sums over the two plates of a pair, as they are read */
+typedef struct {
+  double blank;
+  double peptide1[NUM_CONCENTRATIONS];
+  double peptide2[NUM_CONCENTRATIONS];
+  double control[NUM_CONCENTRATIONS];
+  double lastRow;
+  double bacteria;
+} PLATE_SUMS;
+
+/* The means of a pair, less its blank, and the time it was read */
+typedef struct {
+  double time;
+  double blank;
+  double groups[NUM_GROUPS][NUM_CONCENTRATIONS];
+  double lastRow;
+  double bacteria;
+} PLATE_MEANS;
+
+/*
+ * What micStreamUpdate keeps between calls: how far into the upload it
+ * has read, a hash of the start of what it read (to know the upload
+ * again), the sums of the pair it is part way through, the running
+ * sum of the blanks, and the first pair, last pair and the pair at
+ * the cutoff, if it has been reached.
+ */
+typedef struct {
+  long offset;
+  long identityBytes;
+  unsigned long identity;
+  int numRows;
+  int numPairs;
+  int cutoffReached;
+  double blankSum;
+  PLATE_SUMS partial;
+  PLATE_MEANS first;
+  PLATE_MEANS last;
+  PLATE_MEANS cutoff;
+} STREAM_STATE;
+
+/* File-Scope Variables */
+
+/* The line read from an upload, which is as long as the longest */
+static char *line = NULL;
+static size_t lineSize = 0;
+
+/* File-Scope Prototypes */
+static int readLine(FILE *fp);
+static int readPlateRow(FILE *fp, double *values, int wholeLines);
+static void addPlateRow(PLATE_SUMS *sums, int row, double *values);
+static void pairMeans(PLATE_SUMS *sums, PLATE_MEANS *means);
+static void writeDoubles(FILE *fp, double *values, int numValues);
+static int readDoubles(FILE *fp, double *values, int numValues);
+static unsigned long hashUpload(FILE *fp, long numBytes);
+static int readState(char *fileName, STREAM_STATE *state);
+static void writeState(char *fileName, STREAM_STATE *state);
+static int inhibitedFrom(double *growth, double limit);
+void countPlates(char **fileName, int *numPlates);
+void reducePlates(char **fileName, int *numPairs, double *blanks,
+		  double *peptide1, double *peptide2, double *control,
+		  double *lastRow, double *bacteria);
+void micStreamUpdate(char **stateFile, char **fileName, double *times,
+		     int *numTimes, double *cutoffTime, double *micLimit,
+		     int *numPairs, double *lastTime, int *final,
+		     double *meanBlank, double *growth, int *results);
+
+/*+F
+ ********************************************************
+ *
+ * readLine - read the next line of an upload, however long
+ *
+ * The line buffer is grown until the whole line fits, so a long row
+ * is never taken as two.
+ *
+ * Parameters:
+ *
+ * FILE *fp - the upload
+ *
+ * Returns: 1 if a line was read (into line, with its newline unless it
+ *          is the last and has none), 0 at the end of the file
+ ********************************************************
+ */
+static int readLine(FILE *fp)
+{
+  size_t length = 0;
+  char *grown;
+
+  if (line == NULL) {
+    if ((line = malloc(LINE_SIZE)) == NULL) return(0);
+    lineSize = LINE_SIZE;
+  }
+  while (fgets(line+length,lineSize-length,fp) != NULL) {
+    length += strlen(line+length);
+    if (line[length-1] == '\n') return(1);
+
+    /* No newline: either the end of the file or a full buffer */
+    if (length < lineSize - 1) return(1);
+    if ((grown = realloc(line,2*lineSize)) == NULL) return(0);
+    line = grown;
+    lineSize *= 2;
+  }
+  return(length > 0);
+}
+/*+F
+ ********************************************************
+ *
+ * readPlateRow - read the next row of wells from an upload
+ *
+ * Blank lines are skipped, as read.csv does. Fields that are missing
+ * or are not numbers (quotes aside) are NaN.
+ *
+ * Parameters:
+ *
+ * FILE *fp - the upload
+ * double *values - the PLATE_COLUMNS values, returned
+ * int wholeLines - if set, a last line with no newline, which may be
+ *                  still being written, is not taken
+ *
+ * Returns: 1 if a row was read, 0 at the end of the file
+ ********************************************************
+ */
+static int readPlateRow(FILE *fp, double *values, int wholeLines)
+{
+  char *field, *end;
+  int column;
+
+  do {
+    if (!readLine(fp)) return(0);
+    if (wholeLines && line[strlen(line)-1] != '\n') return(0);
+  } while (strspn(line," \t\r\n") == strlen(line));
+
+  field = line;
+  for (column=0;column<PLATE_COLUMNS;column++) {
+    values[column] = NAN;
+    if (field == NULL) continue;
+    while (*field == ' ' || *field == '"') field++;
+    values[column] = strtod(field,&end);
+    if (end == field) values[column] = NAN;
+    while (*end == ' ' || *end == '"' || *end == '\r' || *end == '\n') end++;
+    if (*end != ',' && *end != '\0') values[column] = NAN;
+    if ((field = strchr(field,',')) != NULL) field++;
+  }
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * addPlateRow - add a row of a plate to the sums of its pair
+ *
+ * Parameters:
+ *
+ * PLATE_SUMS *sums - the sums of the pair
+ * int row - the row in its plate, from 1
+ * double *values - its values
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void addPlateRow(PLATE_SUMS *sums, int row, double *values)
+{
+  int index;
+
+  if (row >= 2 && row <= 7) {
+    sums->blank += values[0];
+    sums->bacteria += values[11];
+  }
+  for (index=0;index<NUM_CONCENTRATIONS;index++) {
+    if (row >= 2 && row <= 4) sums->peptide1[index] += values[index+1];
+    if (row >= 5 && row <= 7) sums->peptide2[index] += values[index+1];
+    if (row == 8) sums->control[index] += values[index+1];
+  }
+  if (row == 9) sums->lastRow += values[1];
+}
+/*+F
+ ********************************************************
+ *
+ * pairMeans - make the sums of a pair into its means, less the blank
+ *
+ * Parameters:
+ *
+ * PLATE_SUMS *sums - the sums of both plates of the pair
+ * PLATE_MEANS *means - the means, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void pairMeans(PLATE_SUMS *sums, PLATE_MEANS *means)
+{
+  int index;
+
+  means->blank = sums->blank / 12.0;
+  means->bacteria = sums->bacteria / 12.0 - means->blank;
+  means->lastRow = sums->lastRow / 2.0 - means->blank;
+  for (index=0;index<NUM_CONCENTRATIONS;index++) {
+    means->groups[0][index] = sums->peptide1[index] / 6.0 - means->blank;
+    means->groups[1][index] = sums->peptide2[index] / 6.0 - means->blank;
+    means->groups[2][index] = sums->control[index] / 2.0 - means->blank;
+  }
+}
+/*+F
+ ********************************************************
+ *
+ * writeDoubles - write numbers to a state file, a line of them
+ *
+ * They are written to full precision, so that nothing changes in
+ * going through the file.
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeDoubles(FILE *fp, double *values, int numValues)
+{
+  int index;
+
+  for (index=0;index<numValues;index++)
+    fprintf(fp,"%s%.17g",index > 0 ? " " : "",values[index]);
+  fprintf(fp,"\n");
+}
+/*+F
+ ********************************************************
+ *
+ * readDoubles - read numbers written by writeDoubles
+ *
+ * Returns: 1 if they were all read, 0 if not
+ ********************************************************
+ */
+static int readDoubles(FILE *fp, double *values, int numValues)
+{
+  char word[64];
+  int index;
+
+  /* NaN and inf are read by strtod, which fscanf may not do */
+  for (index=0;index<numValues;index++) {
+    if (fscanf(fp,"%63s",word) != 1) return(0);
+    values[index] = strtod(word,NULL);
+  }
+  return(1);
+}
+/*+F
+ ********************************************************
+ *
+ * hashUpload - hash the start of an upload
+ *
+ * Parameters:
+ *
+ * FILE *fp - the upload, left positioned after the bytes hashed
+ * long numBytes - how many bytes from the start to hash
+ *
+ * Returns: the hash (djb2) of those bytes, as many as there are
+ ********************************************************
+ */
+static unsigned long hashUpload(FILE *fp, long numBytes)
+{
+  unsigned long hash = 5381;
+  long index;
+  int c;
+
+  fseek(fp,0L,SEEK_SET);
+  for (index=0;index<numBytes && (c = getc(fp)) != EOF;index++)
+    hash = 33*hash + (unsigned char)c;
+  return(hash);
+}
+/*+F
+ ********************************************************
+ *
+ * readState - read the state of a stream
+ *
+ * The state is text, a line of counts and then each set of sums or
+ * means as a line of numbers, so it can be looked at by hand.
+ *
+ * Parameters:
+ *
+ * char *fileName - the state file
+ * STREAM_STATE *state - the state, returned (cleared if there is none)
+ *
+ * Returns: 1 if there was a state, 0 if not
+ ********************************************************
+ */
+static int readState(char *fileName, STREAM_STATE *state)
+{
+  char version[64];
+  int isRead;
+  FILE *fp;
+
+  memset(state,0,sizeof(STREAM_STATE));
+  if ((fp = fopen(fileName,"r")) == NULL) return(0);
+
+  isRead =
+    fgets(version,sizeof(version),fp) != NULL &&
+    !strncmp(version,STATE_VERSION,strlen(STATE_VERSION)) &&
+    fscanf(fp,"%ld %ld %lu %d %d %d",&state->offset,&state->identityBytes,
+	   &state->identity,&state->numRows,&state->numPairs,
+	   &state->cutoffReached) == 6 &&
+    readDoubles(fp,&state->blankSum,1) &&
+    readDoubles(fp,(double *)&state->partial,
+		sizeof(PLATE_SUMS)/sizeof(double)) &&
+    readDoubles(fp,(double *)&state->first,
+		sizeof(PLATE_MEANS)/sizeof(double)) &&
+    readDoubles(fp,(double *)&state->last,
+		sizeof(PLATE_MEANS)/sizeof(double)) &&
+    readDoubles(fp,(double *)&state->cutoff,
+		sizeof(PLATE_MEANS)/sizeof(double));
+  fclose(fp);
+
+  if (!isRead) memset(state,0,sizeof(STREAM_STATE));
+  return(isRead);
+}
+/*+F
+ ********************************************************
+ *
+ * writeState - write the state of a stream, atomically
+ *
+ * Parameters:
+ *
+ * char *fileName - the state file
+ * STREAM_STATE *state - the state
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+static void writeState(char *fileName, STREAM_STATE *state)
+{
+  char tempName[FILENAME_MAX];
+  FILE *fp;
+
+  snprintf(tempName,sizeof(tempName),"%s.tmp",fileName);
+  if ((fp = fopen(tempName,"w")) == NULL) return;
+  fprintf(fp,"%s\n",STATE_VERSION);
+  fprintf(fp,"%ld %ld %lu %d %d %d\n",state->offset,state->identityBytes,
+	  state->identity,state->numRows,state->numPairs,state->cutoffReached);
+  writeDoubles(fp,&state->blankSum,1);
+  writeDoubles(fp,(double *)&state->partial,sizeof(PLATE_SUMS)/sizeof(double));
+  writeDoubles(fp,(double *)&state->first,sizeof(PLATE_MEANS)/sizeof(double));
+  writeDoubles(fp,(double *)&state->last,sizeof(PLATE_MEANS)/sizeof(double));
+  writeDoubles(fp,(double *)&state->cutoff,sizeof(PLATE_MEANS)/sizeof(double));
+  fclose(fp);
+  rename(tempName,fileName);
+}
+/*+F
+ ********************************************************
+ *
+ * inhibitedFrom - find the lowest concentration growth is held at
+ *
+ * The concentrations halve from the first, so this is the last of the
+ * run, from the first, with growth at or below the limit. Growth
+ * below the limit at a lower concentration, after one above, is taken
+ * to be noise.
+ *
+ * Parameters:
+ *
+ * double *growth - the growth at each concentration, in percent
+ * double limit - the most growth that counts as held
+ *
+ * Returns: the concentration, from 1, or 0 if not even the first
+ ********************************************************
+ */
+static int inhibitedFrom(double *growth, double limit)
+{
+  int index;
+
+  for (index=0;index<NUM_CONCENTRATIONS;index++)
+    if (!(growth[index] <= limit)) break;
+  return(index);
+}
+/*+F
+ ********************************************************
+ *
+ * countPlates - count the plates in an upload
+ *
+ * Parameters:
+ *
+ * char **fileName - the upload
+ * int *numPlates - the number of plates, returned (0 if unreadable)
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+void countPlates(char **fileName, int *numPlates)
+{
+  int numRows = 0;
+  double values[PLATE_COLUMNS];
+  FILE *fp;
+
+  *numPlates = 0;
+  if ((fp = fopen(fileName[0],"r")) == NULL) return;
+  while (readPlateRow(fp,values,0)) numRows++;
+  fclose(fp);
+  *numPlates = numRows / PLATE_ROWS;
+}
+/*+F
+ ********************************************************
+ *
+ * reducePlates - reduce an upload to the means of each plate pair
+ *
+ * See the header for what they are. Each pair is summed as it is read
+ * and then divided out, so the upload is read once, a row at a time.
+ * Pairs beyond those in the file are NaN.
+ *
+ * Parameters:
+ *
+ * char **fileName - the upload
+ * int *numPairs - the number of plate pairs wanted
+ * double *blanks - the blank of each pair, returned
+ * double *peptide1, *peptide2, *control, *lastRow - the numPairs by 10
+ *                 matrices of each, returned
+ * double *bacteria - the bacteria of each pair, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+void reducePlates(char **fileName, int *numPairs, double *blanks,
+		  double *peptide1, double *peptide2, double *control,
+		  double *lastRow, double *bacteria)
+{
+  int pair, row, index, out;
+  double values[PLATE_COLUMNS];
+  PLATE_SUMS sums;
+  PLATE_MEANS means;
+  FILE *fp;
+
+  fp = fopen(fileName[0],"r");
+  for (pair=0;pair<*numPairs;pair++) {
+
+    /* Sum both plates of the pair, NaN if they aren't all there */
+    memset(&sums,0,sizeof(sums));
+    for (row=0;row<2*PLATE_ROWS;row++) {
+      if (fp == NULL || !readPlateRow(fp,values,0))
+	for (index=0;index<PLATE_COLUMNS;index++) values[index] = NAN;
+      addPlateRow(&sums,row % PLATE_ROWS + 1,values);
+    }
+
+    /* And make them the means, less the blank */
+    pairMeans(&sums,&means);
+    blanks[pair] = means.blank;
+    bacteria[pair] = means.bacteria;
+    for (index=0;index<NUM_CONCENTRATIONS;index++) {
+      out = pair + index * *numPairs;
+      peptide1[out] = means.groups[0][index];
+      peptide2[out] = means.groups[1][index];
+      control[out] = means.groups[2][index];
+      lastRow[out] = means.lastRow;
+    }
+  }
+  if (fp != NULL) fclose(fp);
+}
+/*+F
+ ********************************************************
+ *
+ * micStreamUpdate - take in the plates added to an upload since last
+ *
+ * The rows added since the last call are read, and each pair they
+ * complete is reduced as reducePlates does and given its time. The
+ * growth at each concentration is, as in mic.R, the rise of the group
+ * from the first pair over that of the bacteria, in percent, at the
+ * first pair read after the cutoff time or, until then, at the last
+ * pair. The MIC is the lowest concentration with growth at most the
+ * limit, the MLC with none, each as its index, from 1 at the highest
+ * concentration, or 0 if there is none.
+ *
+ * The upload is known by a hash of the start of it (up to 4096 bytes)
+ * taken once those bytes have been read, so whole lines. If the upload
+ * is shorter than was read, or starts differently, it is a new one
+ * (even under the same name, and however long) and the stream starts
+ * again. A pair whose time is not in times yet is left
+ * for a later call, as is a line still being written: only one with
+ * no newline yet at the end of the upload. Any line with its newline
+ * is taken whole however long, so the offset always moves on past it.
+ * So each call costs what was added, and the state what one pair does.
+ *
+ * Parameters:
+ *
+ * char **stateFile - the state file, made if not there
+ * char **fileName - the upload
+ * double *times - the time of each pair, in minutes, so far as known
+ * int *numTimes - how many times there are
+ * double *cutoffTime - the time growth is taken at, in minutes (1440)
+ * double *micLimit - the most growth, in percent, at the MIC
+ * int *numPairs - the pairs taken in, returned
+ * double *lastTime - the time of the last of them, returned
+ * int *final - 1 if past the cutoff, so the results won't change, 0 if
+ *              they are from the last pair, returned
+ * double *meanBlank - the mean of the blanks of all pairs, returned
+ * double *growth - the 10 by 3 (peptide 1, peptide 2, control) growth
+ *                  matrix, returned, NaN until there are two pairs
+ * int *results - the MIC and MLC of each group, as above, returned
+ *
+ * Returns: NONE
+ ********************************************************
+ */
+void micStreamUpdate(char **stateFile, char **fileName, double *times,
+		     int *numTimes, double *cutoffTime, double *micLimit,
+		     int *numPairs, double *lastTime, int *final,
+		     double *meanBlank, double *growth, int *results)
+{
+  int group, index;
+  long fileSize;
+  double values[PLATE_COLUMNS];
+  STREAM_STATE state;
+  PLATE_MEANS *at;
+  FILE *fp;
+
+  readState(stateFile[0],&state);
+
+  if ((fp = fopen(fileName[0],"r")) != NULL) {
+    fseek(fp,0L,SEEK_END);
+    fileSize = ftell(fp);
+    if (fileSize < state.offset || (state.identityBytes > 0 &&
+	hashUpload(fp,state.identityBytes) != state.identity))
+      memset(&state,0,sizeof(state));
+    fseek(fp,state.offset,SEEK_SET);
+
+    /* Only take whole pairs whose time we know */
+    while (state.numPairs < *numTimes && readPlateRow(fp,values,1)) {
+      state.offset = ftell(fp);
+      addPlateRow(&state.partial,state.numRows % PLATE_ROWS + 1,values);
+      if (++state.numRows < 2*PLATE_ROWS) continue;
+
+      pairMeans(&state.partial,&state.last);
+      state.last.time = times[state.numPairs];
+      if (state.numPairs++ == 0) state.first = state.last;
+      if (!state.cutoffReached && state.last.time > *cutoffTime) {
+	state.cutoff = state.last;
+	state.cutoffReached = 1;
+      }
+      state.blankSum += state.last.blank;
+      memset(&state.partial,0,sizeof(state.partial));
+      state.numRows = 0;
+    }
+
+    /* Until it is whole, the identity grows with what has been read */
+    if (state.identityBytes < IDENTITY_BYTES &&
+	state.offset > state.identityBytes) {
+      state.identityBytes =
+	state.offset < IDENTITY_BYTES ? state.offset : IDENTITY_BYTES;
+      state.identity = hashUpload(fp,state.identityBytes);
+    }
+    fclose(fp);
+    writeState(stateFile[0],&state);
+  }
+
+  *numPairs = state.numPairs;
+  *lastTime = state.numPairs > 0 ? state.last.time : NAN;
+  *final = state.cutoffReached;
+  *meanBlank = state.numPairs > 0 ? state.blankSum / state.numPairs : NAN;
+
+  at = state.cutoffReached ? &state.cutoff : &state.last;
+  for (group=0;group<NUM_GROUPS;group++) {
+    for (index=0;index<NUM_CONCENTRATIONS;index++)
+      growth[index + group*NUM_CONCENTRATIONS] = state.numPairs < 2 ? NAN :
+	100.0 * (at->groups[group][index] - state.first.groups[group][index]) /
+	(at->bacteria - state.first.bacteria);
+    results[2*group] = state.numPairs < 2 ? 0 :
+      inhibitedFrom(growth + group*NUM_CONCENTRATIONS,*micLimit);
+    results[2*group+1] = state.numPairs < 2 ? 0 :
+      inhibitedFrom(growth + group*NUM_CONCENTRATIONS,0.0);
+  }
+}